@@ -0,0 +1,183 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.hpp"
+
+arena_t::arena_t (size_t chunk_size)
+  : m_head (NULL), m_cur (NULL), m_end (NULL), m_chunk_size (chunk_size),
+    m_used (0), m_reserved (0)
+{
+}
+
+arena_t::~arena_t ()
+{
+  release ();
+}
+
+arena_t::chunk_t *arena_t::new_chunk (size_t size)
+{
+  chunk_t *c = (chunk_t *) malloc (sizeof (chunk_t) + size);
+  if (c == NULL) {
+    return NULL;
+  }
+  c->size = size;
+  c->next = m_head;
+  m_head = c;
+  m_reserved += size;
+  return c;
+}
+
+void *arena_t::alloc (size_t size, size_t align)
+{
+  uintptr_t p = ((uintptr_t) m_cur + align - 1) & ~(uintptr_t)(align - 1);
+
+  if (m_cur == NULL || p + size > (uintptr_t) m_end) {
+    /* large requests get a chunk of their own so that they don't waste
+     * the tail of the current one */
+    if (size + align > m_chunk_size / 4) {
+      chunk_t *c = (chunk_t *) malloc (sizeof (chunk_t) + size + align);
+      if (c == NULL) {
+        return NULL;
+      }
+      c->size = size + align;
+      m_reserved += c->size;
+      m_used += size;
+      if (m_head) {
+        /* keep the current chunk at the head */
+        c->next = m_head->next;
+        m_head->next = c;
+      } else {
+        c->next = NULL;
+        m_head = c;
+      }
+      p = ((uintptr_t)(c + 1) + align - 1) & ~(uintptr_t)(align - 1);
+      return (void *) p;
+    }
+    chunk_t *c = new_chunk (m_chunk_size);
+    if (c == NULL) {
+      return NULL;
+    }
+    m_cur = (char *)(c + 1);
+    m_end = m_cur + c->size;
+    p = ((uintptr_t) m_cur + align - 1) & ~(uintptr_t)(align - 1);
+  }
+  m_cur = (char *)(p + size);
+  m_used += size;
+  return (void *) p;
+}
+
+char *arena_t::dup (const char *s, size_t len)
+{
+  char *p = (char *) alloc (len + 1, 1);
+  if (p == NULL) {
+    return NULL;
+  }
+  memcpy (p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+bool arena_t::unwind (void *p, size_t size)
+{
+  if ((char *) p + size == m_cur) {
+    m_cur = (char *) p;
+    m_used -= size;
+    return true;
+  }
+
+  /* a large allocation has a chunk to itself, right behind the head (or
+   * at the head if it came before any regular chunk); regular chunks hold
+   * other allocations too and are left alone */
+  chunk_t **prev = (m_cur == NULL) ? &m_head : (m_head ? &m_head->next : NULL);
+  chunk_t *c = prev ? *prev : NULL;
+  if (c == NULL || c->size == m_chunk_size || (char *) p < (char *)(c + 1)
+      || (char *) p + size > (char *)(c + 1) + c->size) {
+    return false;
+  }
+  *prev = c->next;
+  m_used -= size;
+  m_reserved -= c->size;
+  free (c);
+  return true;
+}
+
+void arena_t::reset ()
+{
+  chunk_t *keep = NULL;
+  chunk_t *c = m_head;
+
+  /* hold on to one regular chunk so the next fill doesn't malloc */
+  while (c) {
+    chunk_t *next = c->next;
+    if (keep == NULL && c->size == m_chunk_size) {
+      keep = c;
+    } else {
+      free (c);
+    }
+    c = next;
+  }
+  m_head = keep;
+  m_used = 0;
+  m_reserved = 0;
+  m_cur = m_end = NULL;
+  if (keep) {
+    keep->next = NULL;
+    m_reserved = keep->size;
+    m_cur = (char *)(keep + 1);
+    m_end = m_cur + keep->size;
+  }
+}
+
+void arena_t::release ()
+{
+  chunk_t *c = m_head;
+  while (c) {
+    chunk_t *next = c->next;
+    free (c);
+    c = next;
+  }
+  m_head = NULL;
+  m_cur = m_end = NULL;
+  m_used = 0;
+  m_reserved = 0;
+}
+
+char *buf_pool_t::get (size_t len)
+{
+  if (len <= m_size && m_buf != NULL) {
+    return m_buf;
+  }
+  size_t size = m_size ? m_size : 4096;
+  while (size < len) {
+    size *= 2;
+  }
+  char *buf = (char *) malloc (size);
+  if (buf == NULL) {
+    return NULL;
+  }
+  free (m_buf);
+  m_buf = buf;
+  m_size = size;
+  return m_buf;
+}
+
+void buf_pool_t::release ()
+{
+  free (m_buf);
+  m_buf = NULL;
+  m_size = 0;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,133 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * arena.hpp
+ *
+ * Bump allocator used to hold all key/value bytes (and the map nodes
+ * indexing them) of a KVS, plus a growable buffer reused across fences
+ * for the images exchanged.
+ *
+ * Nothing allocated from an arena_t is freed individually: reset ()
+ * drops everything while keeping one chunk around for reuse, and
+ * release () hands all memory back to the system.
+ */
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stddef.h>
+#include <new>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+class arena_t {
+public:
+  arena_t (size_t chunk_size = ARENA_CHUNK_SIZE);
+  ~arena_t ();
+
+  /* returns NULL only if the system is out of memory */
+  void *alloc (size_t size, size_t align = sizeof (void *));
+
+  /* copy len bytes of s into the arena and NUL terminate the copy */
+  char *dup (const char *s, size_t len);
+
+  /* give back the most recent allocation, if p (of size bytes) is it */
+  bool unwind (void *p, size_t size);
+
+  void reset ();
+  void release ();
+
+  size_t used () const { return m_used; }
+  size_t reserved () const { return m_reserved; }
+
+private:
+  struct chunk_t {
+    chunk_t *next;
+    size_t size;
+  };
+
+  arena_t (const arena_t &);
+  arena_t &operator= (const arena_t &);
+
+  chunk_t *new_chunk (size_t size);
+
+  chunk_t *m_head;
+  char *m_cur;
+  char *m_end;
+  size_t m_chunk_size;
+  size_t m_used;
+  size_t m_reserved;
+};
+
+/**
+ * STL allocator drawing from an arena_t. deallocate () is a no-op; the
+ * memory comes back when the arena is reset or released.
+ */
+template <class T>
+struct arena_allocator_t {
+  typedef T value_type;
+
+  arena_allocator_t (arena_t *arena) : m_arena (arena) {}
+  template <class U>
+  arena_allocator_t (const arena_allocator_t<U> &o) : m_arena (o.m_arena) {}
+
+  T *allocate (size_t n)
+  {
+    void *p = m_arena->alloc (n * sizeof (T), alignof (T));
+    if (p == NULL) {
+      throw std::bad_alloc ();
+    }
+    return static_cast<T *> (p);
+  }
+  void deallocate (T *, size_t) {}
+
+  arena_t *m_arena;
+};
+
+template <class T, class U>
+bool operator== (const arena_allocator_t<T> &a, const arena_allocator_t<U> &b)
+{
+  return a.m_arena == b.m_arena;
+}
+
+template <class T, class U>
+bool operator!= (const arena_allocator_t<T> &a, const arena_allocator_t<U> &b)
+{
+  return a.m_arena != b.m_arena;
+}
+
+/**
+ * Growable message buffer that persists across calls so that repeated
+ * exchanges do not go back to malloc. Contents are not preserved when
+ * get () has to grow the buffer.
+ */
+class buf_pool_t {
+public:
+  buf_pool_t () : m_buf (NULL), m_size (0) {}
+  ~buf_pool_t () { release (); }
+
+  char *get (size_t len);
+  void release ();
+  size_t size () const { return m_size; }
+
+private:
+  buf_pool_t (const buf_pool_t &);
+  buf_pool_t &operator= (const buf_pool_t &);
+
+  char *m_buf;
+  size_t m_size;
+};
+
+#endif // ARENA_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
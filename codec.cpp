@@ -0,0 +1,553 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "codec.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+ #define CODEC_X86 1
+ #include <immintrin.h>
+ #define CODEC_SSSE3 __attribute__ ((target ("ssse3")))
+ #define CODEC_AVX2 __attribute__ ((target ("avx2")))
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char b64_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* reverse of b64_digits, -1 for anything else (including '='); filled in
+ * by codec_select () before any decoder can run */
+static int8_t b64_values[256];
+
+/******************************************************************************
+ * Scalar versions, also used for the tails of the vector loops
+ *****************************************************************************/
+
+static inline int hex_value (unsigned char c)
+{
+  if ((unsigned)(c - '0') < 10) {
+    return c - '0';
+  }
+  c |= 0x20;
+  if ((unsigned)(c - 'a') < 6) {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+static void hex_encode_scalar (const uint8_t *src, size_t n, char *dst)
+{
+  for (size_t i = 0; i < n; i++) {
+    dst[2 * i] = hex_digits[src[i] >> 4];
+    dst[2 * i + 1] = hex_digits[src[i] & 0xf];
+  }
+}
+
+static bool hex_decode_scalar (const char *src, size_t n, uint8_t *dst)
+{
+  for (size_t i = 0; i < n; i += 2) {
+    int hi = hex_value (src[i]);
+    int lo = hex_value (src[i + 1]);
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+    dst[i / 2] = (uint8_t)((hi << 4) | lo);
+  }
+  return true;
+}
+
+static void b64_encode_scalar (const uint8_t *src, size_t n, char *dst)
+{
+  size_t i = 0;
+  for (; i + 3 <= n; i += 3) {
+    uint32_t w = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    *dst++ = b64_digits[(w >> 18) & 0x3f];
+    *dst++ = b64_digits[(w >> 12) & 0x3f];
+    *dst++ = b64_digits[(w >> 6) & 0x3f];
+    *dst++ = b64_digits[w & 0x3f];
+  }
+  if (i < n) {
+    uint32_t w = src[i] << 16;
+    if (i + 1 < n) {
+      w |= src[i + 1] << 8;
+    }
+    *dst++ = b64_digits[(w >> 18) & 0x3f];
+    *dst++ = b64_digits[(w >> 12) & 0x3f];
+    *dst++ = (i + 1 < n) ? b64_digits[(w >> 6) & 0x3f] : '=';
+    *dst++ = '=';
+  }
+}
+
+/* n is a multiple of 4; only the last quantum may be padded */
+static bool b64_decode_scalar (const char *src, size_t n, uint8_t *dst)
+{
+  for (size_t i = 0; i < n; i += 4) {
+    const unsigned char *q = (const unsigned char *)src + i;
+    int a = b64_values[q[0]];
+    int b = b64_values[q[1]];
+    int c = b64_values[q[2]];
+    int d = b64_values[q[3]];
+    if (i + 4 == n && q[3] == '=') {
+      if (q[2] == '=') {
+        c = 0;
+      } else if (c < 0) {
+        return false;
+      }
+      d = 0;
+      if ((a | b | c) < 0) {
+        return false;
+      }
+      uint32_t w = (a << 18) | (b << 12) | (c << 6);
+      *dst++ = (uint8_t)(w >> 16);
+      if (q[2] != '=') {
+        *dst++ = (uint8_t)(w >> 8);
+      }
+      return true;
+    }
+    if ((a | b | c | d) < 0) {
+      return false;
+    }
+    uint32_t w = (a << 18) | (b << 12) | (c << 6) | d;
+    *dst++ = (uint8_t)(w >> 16);
+    *dst++ = (uint8_t)(w >> 8);
+    *dst++ = (uint8_t)w;
+  }
+  return true;
+}
+
+#ifdef CODEC_X86
+
+/******************************************************************************
+ * SSSE3: 16 bytes per step, nibbles turned into digits with pshufb
+ *****************************************************************************/
+
+CODEC_SSSE3 static void hex_encode_ssse3 (const uint8_t *src, size_t n,
+                                          char *dst)
+{
+  const __m128i lut = _mm_loadu_si128 ((const __m128i *)hex_digits);
+  const __m128i mask = _mm_set1_epi8 (0x0f);
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i in = _mm_loadu_si128 ((const __m128i *)(src + i));
+    __m128i hi = _mm_shuffle_epi8 (lut, _mm_and_si128 (_mm_srli_epi16 (in, 4),
+                                                       mask));
+    __m128i lo = _mm_shuffle_epi8 (lut, _mm_and_si128 (in, mask));
+    _mm_storeu_si128 ((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8 (hi, lo));
+    _mm_storeu_si128 ((__m128i *)(dst + 2 * i + 16),
+                      _mm_unpackhi_epi8 (hi, lo));
+  }
+  hex_encode_scalar (src + i, n - i, dst + 2 * i);
+}
+
+/* digit values of 16 hex characters; clears lanes of ok that are not
+ * hex digits */
+CODEC_SSSE3 static inline __m128i hex_values_ssse3 (__m128i c, __m128i *ok)
+{
+  const __m128i minus_one = _mm_set1_epi8 (-1);
+  __m128i d = _mm_sub_epi8 (c, _mm_set1_epi8 ('0'));
+  __m128i a = _mm_sub_epi8 (_mm_or_si128 (c, _mm_set1_epi8 (0x20)),
+                            _mm_set1_epi8 ('a'));
+  __m128i is_d = _mm_and_si128 (_mm_cmpgt_epi8 (d, minus_one),
+                                _mm_cmpgt_epi8 (_mm_set1_epi8 (10), d));
+  __m128i is_a = _mm_and_si128 (_mm_cmpgt_epi8 (a, minus_one),
+                                _mm_cmpgt_epi8 (_mm_set1_epi8 (6), a));
+  *ok = _mm_and_si128 (*ok, _mm_or_si128 (is_d, is_a));
+  return _mm_or_si128 (_mm_and_si128 (is_d, d),
+                       _mm_and_si128 (is_a, _mm_add_epi8 (a,
+                                                          _mm_set1_epi8 (10))));
+}
+
+CODEC_SSSE3 static bool hex_decode_ssse3 (const char *src, size_t n,
+                                          uint8_t *dst)
+{
+  /* each pair of nibbles becomes hi * 16 + lo in one 16-bit lane */
+  const __m128i weights = _mm_set1_epi16 (0x0110);
+  __m128i ok = _mm_set1_epi8 (-1);
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m128i v0 = hex_values_ssse3 (
+                   _mm_loadu_si128 ((const __m128i *)(src + i)), &ok);
+    __m128i v1 = hex_values_ssse3 (
+                   _mm_loadu_si128 ((const __m128i *)(src + i + 16)), &ok);
+    __m128i out = _mm_packus_epi16 (_mm_maddubs_epi16 (v0, weights),
+                                    _mm_maddubs_epi16 (v1, weights));
+    _mm_storeu_si128 ((__m128i *)(dst + i / 2), out);
+  }
+  if (_mm_movemask_epi8 (ok) != 0xffff) {
+    return false;
+  }
+  return hex_decode_scalar (src + i, n - i, dst + i / 2);
+}
+
+/* regroup 12 input bytes into 16 6-bit indices, one per byte */
+CODEC_SSSE3 static inline __m128i b64_indices_ssse3 (__m128i in)
+{
+  in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+  __m128i t0 = _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+  __m128i t2 = _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+  return _mm_or_si128 (t1, t3);
+}
+
+/* index -> digit: map each index to one of the alphabet's ranges and add
+ * that range's offset */
+CODEC_SSSE3 static inline __m128i b64_digits_ssse3 (__m128i idx)
+{
+  const __m128i offsets = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0);
+  __m128i range = _mm_subs_epu8 (idx, _mm_set1_epi8 (51));
+  __m128i upper = _mm_cmpgt_epi8 (_mm_set1_epi8 (26), idx);
+  range = _mm_or_si128 (range, _mm_and_si128 (upper, _mm_set1_epi8 (13)));
+  return _mm_add_epi8 (_mm_shuffle_epi8 (offsets, range), idx);
+}
+
+CODEC_SSSE3 static void b64_encode_ssse3 (const uint8_t *src, size_t n,
+                                          char *dst)
+{
+  size_t i = 0;
+
+  /* loads are 16 bytes wide but only 12 are consumed */
+  for (; i + 16 <= n; i += 12, dst += 16) {
+    __m128i in = _mm_loadu_si128 ((const __m128i *)(src + i));
+    _mm_storeu_si128 ((__m128i *)dst, b64_digits_ssse3 (b64_indices_ssse3 (in)));
+  }
+  b64_encode_scalar (src + i, n - i, dst);
+}
+
+/* 16 digits -> 16 6-bit values; false if any is outside the alphabet */
+CODEC_SSSE3 static inline bool b64_values_ssse3 (__m128i in, __m128i *out)
+{
+  const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                        0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                        0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                        0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask = _mm_set1_epi8 (0x0f);
+  __m128i hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (in, 4), mask);
+  __m128i lo_nibbles = _mm_and_si128 (in, mask);
+  __m128i lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+  __m128i hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  __m128i bad = _mm_cmpeq_epi8 (_mm_and_si128 (lo, hi), _mm_setzero_si128 ());
+  if (_mm_movemask_epi8 (bad) != 0xffff) {
+    return false;
+  }
+  /* '/' shares its high nibble with '+' but needs a different offset */
+  __m128i is_slash = _mm_cmpeq_epi8 (in, _mm_set1_epi8 ('/'));
+  __m128i roll = _mm_shuffle_epi8 (lut_roll, _mm_add_epi8 (is_slash,
+                                                           hi_nibbles));
+  *out = _mm_add_epi8 (in, roll);
+  return true;
+}
+
+/* pack 16 6-bit values into 12 bytes at the bottom of the register */
+CODEC_SSSE3 static inline __m128i b64_pack_ssse3 (__m128i v)
+{
+  __m128i ab_bc = _mm_maddubs_epi16 (v, _mm_set1_epi32 (0x01400140));
+  __m128i abcd = _mm_madd_epi16 (ab_bc, _mm_set1_epi32 (0x00011000));
+  return _mm_shuffle_epi8 (abcd, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                14, 13, 12, -1, -1, -1, -1));
+}
+
+CODEC_SSSE3 static bool b64_decode_ssse3 (const char *src, size_t n,
+                                          uint8_t *dst)
+{
+  size_t i = 0;
+
+  /* the last quantum may hold padding and is left to the scalar code */
+  for (; i + 16 + 4 <= n; i += 16, dst += 12) {
+    __m128i v;
+    if (!b64_values_ssse3 (_mm_loadu_si128 ((const __m128i *)(src + i)), &v)) {
+      return false;
+    }
+    v = b64_pack_ssse3 (v);
+    _mm_storel_epi64 ((__m128i *)dst, v);
+    uint32_t tail = (uint32_t)_mm_cvtsi128_si32 (_mm_srli_si128 (v, 8));
+    memcpy (dst + 8, &tail, 4);
+  }
+  return b64_decode_scalar (src + i, n - i, dst);
+}
+
+/******************************************************************************
+ * AVX2: the same algorithms on two 128-bit lanes at once. The tails go to
+ * the (non-VEX) SSSE3 versions, so clear the upper halves first; gcc does
+ * not do so before a tail call.
+ *****************************************************************************/
+
+CODEC_AVX2 static void hex_encode_avx2 (const uint8_t *src, size_t n,
+                                        char *dst)
+{
+  const __m256i lut = _mm256_broadcastsi128_si256 (
+                        _mm_loadu_si128 ((const __m128i *)hex_digits));
+  const __m256i mask = _mm256_set1_epi8 (0x0f);
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m256i in = _mm256_loadu_si256 ((const __m256i *)(src + i));
+    __m256i hi = _mm256_shuffle_epi8 (lut, _mm256_and_si256 (
+                                        _mm256_srli_epi16 (in, 4), mask));
+    __m256i lo = _mm256_shuffle_epi8 (lut, _mm256_and_si256 (in, mask));
+    /* unpack works within lanes, so put the halves back in order */
+    __m256i a = _mm256_unpacklo_epi8 (hi, lo);
+    __m256i b = _mm256_unpackhi_epi8 (hi, lo);
+    _mm256_storeu_si256 ((__m256i *)(dst + 2 * i),
+                         _mm256_permute2x128_si256 (a, b, 0x20));
+    _mm256_storeu_si256 ((__m256i *)(dst + 2 * i + 32),
+                         _mm256_permute2x128_si256 (a, b, 0x31));
+  }
+  _mm256_zeroupper ();
+  hex_encode_ssse3 (src + i, n - i, dst + 2 * i);
+}
+
+CODEC_AVX2 static inline __m256i hex_values_avx2 (__m256i c, __m256i *ok)
+{
+  const __m256i minus_one = _mm256_set1_epi8 (-1);
+  __m256i d = _mm256_sub_epi8 (c, _mm256_set1_epi8 ('0'));
+  __m256i a = _mm256_sub_epi8 (_mm256_or_si256 (c, _mm256_set1_epi8 (0x20)),
+                               _mm256_set1_epi8 ('a'));
+  __m256i is_d = _mm256_and_si256 (_mm256_cmpgt_epi8 (d, minus_one),
+                                   _mm256_cmpgt_epi8 (_mm256_set1_epi8 (10), d));
+  __m256i is_a = _mm256_and_si256 (_mm256_cmpgt_epi8 (a, minus_one),
+                                   _mm256_cmpgt_epi8 (_mm256_set1_epi8 (6), a));
+  *ok = _mm256_and_si256 (*ok, _mm256_or_si256 (is_d, is_a));
+  return _mm256_or_si256 (_mm256_and_si256 (is_d, d),
+                          _mm256_and_si256 (is_a, _mm256_add_epi8 (
+                                              a, _mm256_set1_epi8 (10))));
+}
+
+CODEC_AVX2 static bool hex_decode_avx2 (const char *src, size_t n,
+                                        uint8_t *dst)
+{
+  const __m256i weights = _mm256_set1_epi16 (0x0110);
+  __m256i ok = _mm256_set1_epi8 (-1);
+  size_t i = 0;
+
+  for (; i + 64 <= n; i += 64) {
+    __m256i v0 = hex_values_avx2 (
+                   _mm256_loadu_si256 ((const __m256i *)(src + i)), &ok);
+    __m256i v1 = hex_values_avx2 (
+                   _mm256_loadu_si256 ((const __m256i *)(src + i + 32)), &ok);
+    __m256i out = _mm256_packus_epi16 (_mm256_maddubs_epi16 (v0, weights),
+                                       _mm256_maddubs_epi16 (v1, weights));
+    out = _mm256_permute4x64_epi64 (out, 0xd8);
+    _mm256_storeu_si256 ((__m256i *)(dst + i / 2), out);
+  }
+  if (_mm256_movemask_epi8 (ok) != -1) {
+    return false;
+  }
+  _mm256_zeroupper ();
+  return hex_decode_ssse3 (src + i, n - i, dst + i / 2);
+}
+
+CODEC_AVX2 static void b64_encode_avx2 (const uint8_t *src, size_t n,
+                                        char *dst)
+{
+  const __m256i shuf = _mm256_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+                                        4, 5, 3, 4, 1, 2, 0, 1,
+                                        10, 11, 9, 10, 7, 8, 6, 7,
+                                        4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i offsets = _mm256_setr_epi8 (
+                            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                            '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                            '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+
+  /* each lane takes 12 of the bytes, so the second load starts at +12 */
+  for (; i + 12 + 16 <= n; i += 24, dst += 32) {
+    __m256i in = _mm256_inserti128_si256 (
+                   _mm256_castsi128_si256 (
+                     _mm_loadu_si128 ((const __m128i *)(src + i))),
+                   _mm_loadu_si128 ((const __m128i *)(src + i + 12)), 1);
+    in = _mm256_shuffle_epi8 (in, shuf);
+    __m256i t0 = _mm256_and_si256 (in, _mm256_set1_epi32 (0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+    __m256i t2 = _mm256_and_si256 (in, _mm256_set1_epi32 (0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+    __m256i idx = _mm256_or_si256 (t1, t3);
+    __m256i range = _mm256_subs_epu8 (idx, _mm256_set1_epi8 (51));
+    __m256i upper = _mm256_cmpgt_epi8 (_mm256_set1_epi8 (26), idx);
+    range = _mm256_or_si256 (range, _mm256_and_si256 (upper,
+                                                      _mm256_set1_epi8 (13)));
+    _mm256_storeu_si256 ((__m256i *)dst, _mm256_add_epi8 (
+                           _mm256_shuffle_epi8 (offsets, range), idx));
+  }
+  _mm256_zeroupper ();
+  b64_encode_ssse3 (src + i, n - i, dst);
+}
+
+CODEC_AVX2 static bool b64_decode_avx2 (const char *src, size_t n,
+                                        uint8_t *dst)
+{
+  const __m256i lut_lo = _mm256_setr_epi8 (
+                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8 (
+                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8 (
+                             0, 16, 19, 4, -65, -65, -71, -71,
+                             0, 0, 0, 0, 0, 0, 0, 0,
+                             0, 16, 19, 4, -65, -65, -71, -71,
+                             0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8 (
+                         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i mask = _mm256_set1_epi8 (0x0f);
+  size_t i = 0;
+
+  for (; i + 32 + 4 <= n; i += 32, dst += 24) {
+    __m256i in = _mm256_loadu_si256 ((const __m256i *)(src + i));
+    __m256i hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (in, 4), mask);
+    __m256i lo_nibbles = _mm256_and_si256 (in, mask);
+    __m256i lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+    __m256i hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256 (lo, hi)) {
+      return false;
+    }
+    __m256i is_slash = _mm256_cmpeq_epi8 (in, _mm256_set1_epi8 ('/'));
+    __m256i roll = _mm256_shuffle_epi8 (lut_roll, _mm256_add_epi8 (
+                                          is_slash, hi_nibbles));
+    __m256i v = _mm256_add_epi8 (in, roll);
+    v = _mm256_maddubs_epi16 (v, _mm256_set1_epi32 (0x01400140));
+    v = _mm256_madd_epi16 (v, _mm256_set1_epi32 (0x00011000));
+    v = _mm256_shuffle_epi8 (v, pack);
+    /* 12 bytes at the bottom of each lane; close the gap between them */
+    v = _mm256_permutevar8x32_epi32 (v, _mm256_setr_epi32 (0, 1, 2, 4, 5, 6,
+                                                           3, 7));
+    _mm_storeu_si128 ((__m128i *)dst, _mm256_castsi256_si128 (v));
+    _mm_storel_epi64 ((__m128i *)(dst + 16), _mm256_extracti128_si256 (v, 1));
+  }
+  _mm256_zeroupper ();
+  return b64_decode_ssse3 (src + i, n - i, dst);
+}
+
+#endif // CODEC_X86
+
+/******************************************************************************
+ * Dispatch
+ *****************************************************************************/
+
+struct codec_impl_t {
+  const char *name;
+  void (*hex_encode) (const uint8_t *, size_t, char *);
+  bool (*hex_decode) (const char *, size_t, uint8_t *);
+  void (*b64_encode) (const uint8_t *, size_t, char *);
+  bool (*b64_decode) (const char *, size_t, uint8_t *);
+};
+
+static const codec_impl_t codec_scalar = {
+  "scalar", hex_encode_scalar, hex_decode_scalar,
+  b64_encode_scalar, b64_decode_scalar
+};
+
+#ifdef CODEC_X86
+static const codec_impl_t codec_ssse3 = {
+  "ssse3", hex_encode_ssse3, hex_decode_ssse3,
+  b64_encode_ssse3, b64_decode_ssse3
+};
+
+static const codec_impl_t codec_avx2 = {
+  "avx2", hex_encode_avx2, hex_decode_avx2,
+  b64_encode_avx2, b64_decode_avx2
+};
+#endif
+
+static const codec_impl_t *codec_select ()
+{
+  memset (b64_values, -1, sizeof (b64_values));
+  for (int i = 0; i < 64; i++) {
+    b64_values[(unsigned char)b64_digits[i]] = (int8_t)i;
+  }
+
+#ifdef CODEC_X86
+  const char *cap = getenv ("PMI_MPI_CODEC");
+  if (cap != NULL && strcmp (cap, "scalar") == 0) {
+    return &codec_scalar;
+  }
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")
+      && (cap == NULL || strcmp (cap, "avx2") == 0)) {
+    return &codec_avx2;
+  }
+  if (__builtin_cpu_supports ("ssse3")) {
+    return &codec_ssse3;
+  }
+#endif
+  return &codec_scalar;
+}
+
+static const codec_impl_t &codec ()
+{
+  static const codec_impl_t *impl = codec_select ();
+  return *impl;
+}
+
+void codec_hex_encode (const uint8_t *src, size_t n, char *dst)
+{
+  codec ().hex_encode (src, n, dst);
+}
+
+bool codec_hex_decode (const char *src, size_t n, uint8_t *dst)
+{
+  if (n % 2 != 0) {
+    return false;
+  }
+  return codec ().hex_decode (src, n, dst);
+}
+
+void codec_base64_encode (const uint8_t *src, size_t n, char *dst)
+{
+  codec ().b64_encode (src, n, dst);
+}
+
+size_t codec_base64_decoded_len (const char *src, size_t n)
+{
+  if (n % 4 != 0) {
+    return (size_t) -1;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  return n / 4 * 3 - (src[n - 1] == '=') - (src[n - 2] == '=');
+}
+
+bool codec_base64_decode (const char *src, size_t n, uint8_t *dst)
+{
+  if (n % 4 != 0) {
+    return false;
+  }
+  return codec ().b64_decode (src, n, dst);
+}
+
+const char *codec_impl_name ()
+{
+  return codec ().name;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,50 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * codec.hpp
+ *
+ * Hex and base64 (RFC 4648, padded) encoders and decoders for the binary
+ * blobs PMI clients squeeze into string values. Each routine has a scalar
+ * version plus SSSE3 and AVX2 versions on x86; the widest one the CPU
+ * supports is picked on first use. PMI_MPI_CODEC=scalar|ssse3|avx2 caps
+ * the choice, which is mostly useful for testing.
+ *
+ * Hex is encoded in lower case and decoded in either case. Decoders
+ * return false on any character outside the alphabet (or misplaced
+ * padding), in which case the contents of dst are unspecified.
+ */
+
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+inline size_t codec_hex_encoded_len (size_t n) { return 2 * n; }
+void codec_hex_encode (const uint8_t *src, size_t n, char *dst);
+/* n must be even; writes n / 2 bytes */
+bool codec_hex_decode (const char *src, size_t n, uint8_t *dst);
+
+inline size_t codec_base64_encoded_len (size_t n) { return 4 * ((n + 2) / 3); }
+void codec_base64_encode (const uint8_t *src, size_t n, char *dst);
+/* size of the decoded form of src, or (size_t) -1 if n is not a multiple
+ * of 4; the padding is not validated here */
+size_t codec_base64_decoded_len (const char *src, size_t n);
+bool codec_base64_decode (const char *src, size_t n, uint8_t *dst);
+
+/* "scalar", "ssse3" or "avx2" */
+const char *codec_impl_name ();
+
+#endif // CODEC_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,211 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * codec_bench.cpp
+ *
+ * Round trip checks and throughput of the hex and base64 codec. The
+ * implementation is picked as in the library, so PMI_MPI_CODEC=scalar,
+ * ssse3 or avx2 selects the one under test; 'make bench' runs each. The
+ * checks compare every length up to a few vectors against a plain
+ * reference encoder, decode the result back, and feed the decoders upper
+ * case hex and misplaced characters. It links only codec.o.
+ *
+ * Usage: codec_bench [iterations]
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "codec.hpp"
+
+static double now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static std::string ref_hex (const uint8_t *src, size_t n)
+{
+  std::string out;
+  for (size_t i = 0; i < n; i++) {
+    out += "0123456789abcdef"[src[i] >> 4];
+    out += "0123456789abcdef"[src[i] & 0xf];
+  }
+  return out;
+}
+
+static std::string ref_base64 (const uint8_t *src, size_t n)
+{
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < n; i += 3) {
+    uint32_t v = src[i] << 16;
+    if (i + 1 < n) {
+      v |= src[i + 1] << 8;
+    }
+    if (i + 2 < n) {
+      v |= src[i + 2];
+    }
+    out += digits[v >> 18];
+    out += digits[(v >> 12) & 0x3f];
+    out += i + 1 < n ? digits[(v >> 6) & 0x3f] : '=';
+    out += i + 2 < n ? digits[v & 0x3f] : '=';
+  }
+  return out;
+}
+
+/* every length up to a few AVX2 vectors, so that each loop and tail of
+ * the vector versions is taken */
+static int check (void)
+{
+  int bad = 0;
+  std::vector<uint8_t> src (300), out (300);
+  for (size_t i = 0; i < src.size (); i++) {
+    src[i] = (uint8_t) (i * 167 + 13);
+  }
+
+  for (size_t n = 0; n <= src.size (); n++) {
+    std::string enc (codec_hex_encoded_len (n), '\0');
+    codec_hex_encode (src.data (), n, &enc[0]);
+    if (enc != ref_hex (src.data (), n)) {
+      fprintf (stderr, "hex encode of %zu bytes differs\n", n);
+      bad++;
+    }
+    if (!codec_hex_decode (enc.data (), enc.size (), out.data ())
+        || memcmp (out.data (), src.data (), n) != 0) {
+      fprintf (stderr, "hex decode of %zu bytes differs\n", n);
+      bad++;
+    }
+    for (size_t j = 0; j < enc.size (); j++) {
+      enc[j] = toupper (enc[j]);
+    }
+    if (!codec_hex_decode (enc.data (), enc.size (), out.data ())
+        || memcmp (out.data (), src.data (), n) != 0) {
+      fprintf (stderr, "upper case hex decode of %zu bytes differs\n", n);
+      bad++;
+    }
+    for (size_t j = 0; j < enc.size (); j += 7) {
+      std::string broken = enc;
+      broken[j] = 'g';
+      if (codec_hex_decode (broken.data (), broken.size (), out.data ())) {
+        fprintf (stderr, "hex decode of %zu bytes took 'g' at %zu\n", n, j);
+        bad++;
+      }
+    }
+
+    enc.assign (codec_base64_encoded_len (n), '\0');
+    codec_base64_encode (src.data (), n, &enc[0]);
+    if (enc != ref_base64 (src.data (), n)) {
+      fprintf (stderr, "base64 encode of %zu bytes differs\n", n);
+      bad++;
+    }
+    if (codec_base64_decoded_len (enc.data (), enc.size ()) != n
+        || !codec_base64_decode (enc.data (), enc.size (), out.data ())
+        || memcmp (out.data (), src.data (), n) != 0) {
+      fprintf (stderr, "base64 decode of %zu bytes differs\n", n);
+      bad++;
+    }
+    for (size_t j = 0; j + 4 < enc.size (); j += 5) {
+      std::string broken = enc;
+      broken[j] = j % 2 ? '=' : '.';
+      if (codec_base64_decode (broken.data (), broken.size (), out.data ())) {
+        fprintf (stderr, "base64 decode of %zu bytes took '%c' at %zu\n", n,
+                 broken[j], j);
+        bad++;
+      }
+    }
+  }
+  return bad;
+}
+
+/* GB/s of the binary form over blobs of len bytes, as many as make up
+ * about a megabyte */
+static void bench (size_t len, int iters)
+{
+  size_t count = (1 << 20) / len;
+  std::vector<uint8_t> src (count * len), out (count * len);
+  for (size_t i = 0; i < src.size (); i++) {
+    src[i] = (uint8_t) (i * 167 + 13);
+  }
+  std::string hex (count * codec_hex_encoded_len (len), '\0');
+  std::string b64 (count * codec_base64_encoded_len (len), '\0');
+  size_t hex_len = codec_hex_encoded_len (len);
+  size_t b64_len = codec_base64_encoded_len (len);
+  double sec[4] = { 0, 0, 0, 0 };
+
+  for (int it = 0; it < iters; it++) {
+    double t0 = now ();
+    for (size_t i = 0; i < count; i++) {
+      codec_hex_encode (&src[i * len], len, &hex[i * hex_len]);
+    }
+    double t1 = now ();
+    for (size_t i = 0; i < count; i++) {
+      codec_hex_decode (&hex[i * hex_len], hex_len, &out[i * len]);
+    }
+    double t2 = now ();
+    for (size_t i = 0; i < count; i++) {
+      codec_base64_encode (&src[i * len], len, &b64[i * b64_len]);
+    }
+    double t3 = now ();
+    for (size_t i = 0; i < count; i++) {
+      codec_base64_decode (&b64[i * b64_len], b64_len, &out[i * len]);
+    }
+    double t4 = now ();
+    sec[0] += t1 - t0;
+    sec[1] += t2 - t1;
+    sec[2] += t3 - t2;
+    sec[3] += t4 - t3;
+  }
+  double bytes = (double) src.size () * iters;
+  printf ("%-7s %8zu %9.2f %9.2f %9.2f %9.2f\n", codec_impl_name (), len,
+          bytes / sec[0] / 1e9, bytes / sec[1] / 1e9,
+          bytes / sec[2] / 1e9, bytes / sec[3] / 1e9);
+}
+
+int main (int argc, char *argv[])
+{
+  static const size_t lens[] = { 16, 64, 256, 4096, 1 << 20 };
+  const char *want = getenv ("PMI_MPI_CODEC");
+  int iters = 20;
+
+  if (argc > 1 && (iters = atoi (argv[1])) <= 0) {
+    fprintf (stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+  if (want != NULL && strcmp (want, codec_impl_name ()) != 0) {
+    printf ("%s not supported here, %s skipped\n", want, want);
+    return 0;
+  }
+
+  int bad = check ();
+  if (bad != 0) {
+    fprintf (stderr, "%s: %d round trip checks failed\n", codec_impl_name (),
+             bad);
+    return 1;
+  }
+
+  printf ("%-7s %8s %9s %9s %9s %9s\n", "codec", "bytes", "hex_enc",
+          "hex_dec", "b64_enc", "b64_dec");
+  for (size_t i = 0; i < sizeof (lens) / sizeof (lens[0]); i++) {
+    bench (lens[i], iters);
+  }
+  return 0;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,183 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <system_error>
+#include <vector>
+#include "fetch.hpp"
+
+static std::atomic<unsigned> next_reply (0);
+
+/* sleep a little longer each time nothing has arrived */
+static void idle (long *delay_us)
+{
+  struct timespec ts = { 0, *delay_us * 1000 };
+  nanosleep (&ts, NULL);
+  if (*delay_us < FETCH_MAX_IDLE_US) {
+    *delay_us *= 2;
+  }
+}
+
+/* replies are a status byte and the value; each request in flight from
+ * this process gets a tag of its own */
+int fetch_remote (MPI_Comm comm, int home, uint32_t space, uint64_t epoch,
+                  const char *key, size_t key_len, std::string *value)
+{
+  fetch_request_hdr_t hdr;
+  hdr.space = space;
+  hdr.reply_tag = FETCH_REPLY_TAG + next_reply++ % FETCH_REPLY_TAGS;
+  hdr.epoch = epoch;
+  std::string req ((const char *) &hdr, sizeof (hdr));
+  req.append (key, key_len);
+  if (req.size () > INT_MAX
+      || MPI_Send (&req[0], req.size (), MPI_CHAR, home, FETCH_REQUEST_TAG,
+                   comm) != MPI_SUCCESS) {
+    return -1;
+  }
+
+  MPI_Message msg;
+  MPI_Status status;
+  int flag = 0;
+  long delay = 1;
+  for (;;) {
+    if (MPI_Improbe (home, hdr.reply_tag, comm, &flag, &msg, &status)
+        != MPI_SUCCESS) {
+      return -1;
+    }
+    if (flag) {
+      break;
+    }
+    idle (&delay);
+  }
+  int count;
+  MPI_Get_count (&status, MPI_CHAR, &count);
+  std::vector<char> reply (count > 0 ? count : 1);
+  if (MPI_Mrecv (reply.data (), count, MPI_CHAR, &msg, &status) != MPI_SUCCESS
+      || count < 1) {
+    return -1;
+  }
+  if (reply[0] == 0) {
+    return 0;
+  }
+  value->assign (reply.data () + 1, count - 1);
+  return 1;
+}
+
+fetch_server_t::fetch_server_t ()
+  : m_comm (MPI_COMM_NULL), m_stopping (false), m_running (false)
+{
+}
+
+fetch_server_t::~fetch_server_t ()
+{
+  stop ();
+}
+
+bool fetch_server_t::start (MPI_Comm comm, fetch_serve_t serve)
+{
+  if (m_running) {
+    return true;
+  }
+  m_comm = comm;
+  m_serve = serve;
+  m_stopping = false;
+  try {
+    m_thread = std::thread (&fetch_server_t::run, this);
+  } catch (const std::system_error &) {
+    return false;
+  }
+  m_running = true;
+  return true;
+}
+
+void fetch_server_t::stop ()
+{
+  if (!m_running) {
+    return;
+  }
+  m_stopping = true;
+  m_thread.join ();
+  m_running = false;
+}
+
+/* false if the request has to wait */
+bool fetch_server_t::answer (const request_t &req)
+{
+  std::string value;
+  int found = m_serve (req.hdr.space, req.hdr.epoch, req.key.data (),
+                       req.key.size (), &value);
+  if (found < 0) {
+    return false;
+  }
+  std::string reply (1, found ? 1 : 0);
+  reply += value;
+  if (reply.size () > INT_MAX) {
+    reply.assign (1, 0);
+  }
+  MPI_Send (&reply[0], reply.size (), MPI_CHAR, req.source,
+            req.hdr.reply_tag, m_comm);
+  return true;
+}
+
+void fetch_server_t::run ()
+{
+  std::deque<request_t> waiting;
+  long delay = 1;
+  while (!m_stopping.load ()) {
+    bool busy = false;
+    for (size_t n = waiting.size (); n > 0; n--) {
+      request_t req = waiting.front ();
+      waiting.pop_front ();
+      if (answer (req)) {
+        busy = true;
+      } else {
+        waiting.push_back (req);
+      }
+    }
+
+    MPI_Message msg;
+    MPI_Status status;
+    int flag = 0;
+    if (MPI_Improbe (MPI_ANY_SOURCE, FETCH_REQUEST_TAG, m_comm, &flag, &msg,
+                     &status) != MPI_SUCCESS) {
+      break;
+    }
+    if (flag) {
+      int count;
+      MPI_Get_count (&status, MPI_CHAR, &count);
+      std::vector<char> buf (count > 0 ? count : 1);
+      if (MPI_Mrecv (buf.data (), count, MPI_CHAR, &msg, &status)
+          == MPI_SUCCESS && (size_t) count >= sizeof (fetch_request_hdr_t)) {
+        request_t req;
+        req.source = status.MPI_SOURCE;
+        memcpy (&req.hdr, buf.data (), sizeof (req.hdr));
+        req.key.assign (buf.data () + sizeof (req.hdr),
+                        count - sizeof (req.hdr));
+        if (!answer (req)) {
+          waiting.push_back (req);
+        }
+      }
+      busy = true;
+    }
+
+    if (busy) {
+      delay = 1;
+    } else {
+      idle (&delay);
+    }
+  }
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
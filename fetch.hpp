@@ -0,0 +1,94 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * fetch.hpp
+ *
+ * Point to point lookups of KVS entries a process no longer holds. Every
+ * entry has a home rank that keeps it: the rank of a rank template key,
+ * or the key's hash modulo the job size otherwise. A process looks up
+ * what it evicted by sending the key to the home, whose server thread
+ * answers from its own snapshot.
+ *
+ * Requests carry the sender's count of full fences, and a server holds
+ * back requests from ahead of its own until it has caught up. The server
+ * never takes a space's lock, so it keeps answering while its process
+ * waits in a fence for the very process asking.
+ *
+ * Both ends poll with MPI_Improbe and sleep between polls, which needs
+ * MPI_THREAD_MULTIPLE.
+ */
+
+#ifndef FETCH_HPP
+#define FETCH_HPP
+
+#include <mpi.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#define FETCH_REQUEST_TAG 1
+#define FETCH_REPLY_TAG 2
+#define FETCH_REPLY_TAGS 4096
+#define FETCH_MAX_IDLE_US 1000
+
+struct fetch_request_hdr_t {
+  uint32_t space;
+  uint32_t reply_tag;
+  uint64_t epoch;
+};
+
+/* (space, epoch, key, key_len, value) -> 1 found, 0 missing, or -1 if
+ * the request cannot be answered yet */
+typedef std::function<int (uint32_t, uint64_t, const char *, size_t,
+                           std::string *)> fetch_serve_t;
+
+/* ask home for key; 1 with value set if it has the key, 0 if not, -1 on
+ * error */
+int fetch_remote (MPI_Comm comm, int home, uint32_t space, uint64_t epoch,
+                  const char *key, size_t key_len, std::string *value);
+
+class fetch_server_t {
+public:
+  fetch_server_t ();
+  ~fetch_server_t ();
+
+  bool start (MPI_Comm comm, fetch_serve_t serve);
+  /* only once no process will send more requests */
+  void stop ();
+  bool running () const { return m_running; }
+
+private:
+  fetch_server_t (const fetch_server_t &);
+  fetch_server_t &operator= (const fetch_server_t &);
+
+  struct request_t {
+    int source;
+    fetch_request_hdr_t hdr;
+    std::string key;
+  };
+
+  void run ();
+  bool answer (const request_t &req);
+
+  std::thread m_thread;
+  MPI_Comm m_comm;
+  fetch_serve_t m_serve;
+  std::atomic<bool> m_stopping;
+  bool m_running;
+};
+
+#endif // FETCH_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,702 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "kvs_snapshot.hpp"
+#include "parallel.hpp"
+
+/* give up on a bucket after this many displacements; only reachable if
+ * two keys share a full 64-bit hash */
+#define KVS_SNAPSHOT_MAX_DISP (1 << 20)
+
+static inline uint64_t displace (uint64_t h, int32_t d, uint64_t n)
+{
+  return kv_mix64 (h + (uint64_t) d * 0x9e3779b97f4a7c15ULL) % n;
+}
+
+static inline uint64_t align8 (uint64_t off)
+{
+  return (off + 7) & ~7ULL;
+}
+
+/* the block comes from the high half of the hash (the perfect hash uses
+ * it modulo nslots); the bit positions come from a remix of it */
+static inline const uint64_t *bloom_block (const uint64_t *bloom,
+                                           uint64_t nblocks, uint64_t h)
+{
+  uint64_t b = ((h >> 32) * nblocks) >> 32;
+  return bloom + b * (KVS_BLOOM_BLOCK_BITS / 64);
+}
+
+static void bloom_add (uint64_t *bloom, uint64_t nblocks, uint64_t h)
+{
+  uint64_t *block = (uint64_t *) bloom_block (bloom, nblocks, h);
+  uint64_t bits = kv_mix64 (h);
+  for (int i = 0; i < KVS_BLOOM_HASHES; i++, bits >>= 9) {
+    block[(bits & 511) >> 6] |= 1ULL << (bits & 63);
+  }
+}
+
+uint64_t kvs_snapshot_t::hash (const char *key, size_t len)
+{
+  return kv_hash (key, len);
+}
+
+kvs_snapshot_t::kvs_snapshot_t (char *image, size_t mapped)
+  : m_image (image), m_mapped (mapped)
+{
+  m_hdr = (const kvs_snapshot_hdr_t *) image;
+  m_bloom = (const uint64_t *)(image + m_hdr->bloom_off);
+  m_disp = (const int32_t *)(image + m_hdr->disp_off);
+  m_slots = (const kvs_slot_t *)(image + m_hdr->slots_off);
+  m_order = (const uint32_t *)(image + m_hdr->order_off);
+  m_evicted = (const uint64_t *)(image + m_hdr->evicted_off);
+  m_cols = (const kvs_col_t *)(image + m_hdr->cols_off);
+  m_data = image + m_hdr->data_off;
+}
+
+kvs_snapshot_t::~kvs_snapshot_t ()
+{
+  if (m_mapped > 0) {
+    munmap (m_image, m_mapped);
+  } else {
+    free (m_image);
+  }
+}
+
+bool kvs_snapshot_t::save (const char *path) const
+{
+  char tmp[4096];
+  if (snprintf (tmp, sizeof (tmp), "%s.%d", path, (int) getpid ())
+      >= (int) sizeof (tmp)) {
+    return false;
+  }
+  int fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const char *p = m_image;
+  size_t left = m_hdr->size;
+  while (left > 0) {
+    ssize_t n = write (fd, p, left);
+    if (n <= 0) {
+      break;
+    }
+    p += n;
+    left -= n;
+  }
+  if (close (fd) != 0 || left > 0 || rename (tmp, path) != 0) {
+    unlink (tmp);
+    return false;
+  }
+  return true;
+}
+
+/* the sections must lie in order within the image */
+static bool valid_hdr (const kvs_snapshot_hdr_t *hdr, size_t size)
+{
+  return hdr->magic == KVS_SNAPSHOT_MAGIC && hdr->size == size
+         && hdr->bloom_off >= sizeof (*hdr)
+         && hdr->bloom_off + hdr->bloom_blocks * 64 <= hdr->disp_off
+         && hdr->disp_off + hdr->nslots * sizeof (int32_t) <= hdr->slots_off
+         && hdr->slots_off + hdr->nslots * sizeof (kvs_slot_t)
+            <= hdr->order_off
+         && hdr->order_off + hdr->nslots * sizeof (uint32_t)
+            <= hdr->evicted_off
+         && hdr->evicted_off + hdr->nevicted * sizeof (uint64_t)
+            <= hdr->cols_off
+         && hdr->cols_off + hdr->ncols * sizeof (kvs_col_t) <= hdr->data_off
+         && hdr->data_off <= size;
+}
+
+kvs_snapshot_t *kvs_snapshot_t::load (const char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *image = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (kvs_snapshot_hdr_t)) {
+    image = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close (fd);
+  if (image == MAP_FAILED) {
+    return NULL;
+  }
+  if (!valid_hdr ((const kvs_snapshot_hdr_t *) image, st.st_size)) {
+    munmap (image, st.st_size);
+    return NULL;
+  }
+  return new kvs_snapshot_t ((char *) image, st.st_size);
+}
+
+/*
+ * Place the slots of a hash and displace table. Buckets are filled
+ * largest first; multi-key buckets search for a displacement that sends
+ * all their keys to free slots, single-key buckets take the next free
+ * slot directly (stored as -(slot + 1)) and empty buckets keep 0.
+ */
+static bool place (const std::vector<uint64_t> &hashes, int32_t *disp,
+                   uint32_t *slot_of)
+{
+  uint64_t n = hashes.size ();
+  std::vector<uint32_t> start (n + 1, 0);
+  std::vector<uint32_t> items (n);
+  std::vector<uint32_t> buckets;
+  std::vector<char> taken (n, 0);
+  std::vector<uint64_t> pos;
+
+  /* group entries by bucket with a counting sort */
+  for (uint64_t i = 0; i < n; i++) {
+    start[hashes[i] % n + 1]++;
+  }
+  for (uint64_t b = 0; b < n; b++) {
+    start[b + 1] += start[b];
+    if (start[b + 1] > start[b]) {
+      buckets.push_back (b);
+    }
+  }
+  std::vector<uint32_t> fill (start.begin (), start.end () - 1);
+  for (uint64_t i = 0; i < n; i++) {
+    items[fill[hashes[i] % n]++] = i;
+  }
+  std::stable_sort (buckets.begin (), buckets.end (),
+                    [&start] (uint32_t a, uint32_t b) {
+                      return start[a + 1] - start[a] > start[b + 1] - start[b];
+                    });
+  memset (disp, 0, n * sizeof (int32_t));
+
+  uint64_t free_slot = 0;
+  std::vector<uint32_t>::iterator bi;
+  for (bi = buckets.begin (); bi != buckets.end (); bi++) {
+    uint32_t b = *bi;
+    uint32_t first = start[b];
+    uint32_t size = start[b + 1] - first;
+
+    if (size == 1) {
+      while (taken[free_slot]) {
+        free_slot++;
+      }
+      taken[free_slot] = 1;
+      slot_of[items[first]] = free_slot;
+      disp[b] = -(int32_t) free_slot - 1;
+      continue;
+    }
+
+    int32_t d;
+    for (d = 1; d < KVS_SNAPSHOT_MAX_DISP; d++) {
+      uint32_t k;
+      pos.clear ();
+      for (k = 0; k < size; k++) {
+        uint64_t p = displace (hashes[items[first + k]], d, n);
+        if (taken[p]) {
+          break;
+        }
+        taken[p] = 1;
+        pos.push_back (p);
+      }
+      if (k == size) {
+        break;
+      }
+      for (k = 0; k < pos.size (); k++) {
+        taken[pos[k]] = 0;
+      }
+    }
+    if (d == KVS_SNAPSHOT_MAX_DISP) {
+      return false;
+    }
+    for (uint32_t k = 0; k < size; k++) {
+      slot_of[items[first + k]] = pos[k];
+    }
+    disp[b] = d;
+  }
+  return true;
+}
+
+/* stands in for a template value left out by subset () */
+static const char col_evicted_mark[1] = { 0 };
+
+/* a column of the snapshot being built, from base, delta or both */
+struct col_src_t {
+  kv_str_t prefix;
+  kv_str_t suffix;
+  const kvs_snapshot_t *base;
+  size_t base_col;
+  const rank_col_t *delta;
+  uint64_t nranks;
+};
+
+static bool col_src_value (const col_src_t &c, uint64_t r, kv_str_t *out)
+{
+  if (c.delta && r < c.delta->vals.size () && c.delta->vals[r].ptr) {
+    *out = c.delta->vals[r];
+    return true;
+  }
+  if (c.base && c.base->col_evicted (c.base_col, r)) {
+    out->ptr = col_evicted_mark;
+    out->len = 0;
+    return true;
+  }
+  return c.base && c.base->col_value (c.base_col, r, out);
+}
+
+/* the delta is what wrap decoded from images, then what is in its map
+ * and columns: everything if nothing was decoded, else values routed to
+ * this rank alone after the images were */
+kvs_snapshot_t *kvs_snapshot_t::build (const kvs_snapshot_t *base,
+                                       const map_wrap_t &wrap)
+{
+  if (wrap.m_decoded.valid) {
+    kvs_snapshot_t *snap = build_from (base, wrap.m_decoded.keys,
+                                       wrap.m_decoded.vals,
+                                       wrap.m_decoded.cols, wrap.m_threads);
+    size_t nset = 0;
+    for (size_t c = 0; c < wrap.m_cols.size (); c++) {
+      nset += wrap.m_cols[c].nset;
+    }
+    if (snap == NULL || (wrap.m_map.empty () && nset == 0)) {
+      return snap;
+    }
+    base = snap;
+  }
+  std::unique_ptr<const kvs_snapshot_t> decoded (wrap.m_decoded.valid ? base
+                                                                      : NULL);
+  std::vector<kv_str_t> keys;
+  std::vector<kv_str_t> vals;
+  keys.reserve (wrap.m_map.size ());
+  vals.reserve (wrap.m_map.size ());
+  kv_map_t::const_iterator i;
+  for (i = wrap.m_map.begin (); i != wrap.m_map.end (); i++) {
+    keys.push_back (i->first);
+    vals.push_back (i->second);
+  }
+  return build_from (base, keys, vals, wrap.m_cols, wrap.m_threads);
+}
+
+/* a snapshot with the same columns keeps lookups of every key routed the
+ * same way, even where the value itself is gone */
+kvs_snapshot_t *kvs_snapshot_t::subset (const kvs_snapshot_t *snap,
+                                        kvs_slot_filter_t keep,
+                                        int rank, size_t *nevicted)
+{
+  std::vector<kv_str_t> keys;
+  std::vector<kv_str_t> vals;
+  std::vector<rank_col_t> cols (snap->col_count ());
+  std::vector<uint64_t> evicted (snap->m_evicted,
+                                 snap->m_evicted + snap->evicted_count ());
+  size_t dropped = 0;
+  for (size_t i = 0; i < snap->count (); i++) {
+    const kvs_slot_t *s = snap->slot_in_order (i);
+    if (keep (s)) {
+      keys.push_back (snap->key (s));
+      vals.push_back (snap->value (s));
+    } else {
+      evicted.push_back (s->hash);
+      dropped++;
+    }
+  }
+  std::sort (evicted.begin (), evicted.end ());
+  evicted.erase (std::unique (evicted.begin (), evicted.end ()),
+                 evicted.end ());
+  for (size_t c = 0; c < cols.size (); c++) {
+    const kvs_col_t *col = snap->col (c);
+    kv_str_t none = { NULL, 0 };
+    cols[c].prefix.assign (snap->m_data + col->prefix_off, col->prefix_len);
+    cols[c].suffix.assign (snap->m_data + col->suffix_off, col->suffix_len);
+    cols[c].vals.assign (col->nranks, none);
+    cols[c].nset = 1;
+    for (uint64_t r = 0; r < col->nranks; r++) {
+      kv_str_t v;
+      if (snap->col_value (c, r, &v)) {
+        if ((int) r == rank) {
+          cols[c].vals[r] = v;
+        } else {
+          cols[c].vals[r].ptr = col_evicted_mark;
+          dropped++;
+        }
+      } else if (snap->col_evicted (c, r)) {
+        cols[c].vals[r].ptr = col_evicted_mark;
+      }
+    }
+  }
+  *nevicted = dropped;
+  return build_from (NULL, keys, vals, cols, 1, &evicted);
+}
+
+/* delta keys are in key order and need not be NUL terminated; the
+ * hashes of evicted keys (those of base by default) are kept as they are */
+kvs_snapshot_t *kvs_snapshot_t::build_from (const kvs_snapshot_t *base,
+                                            const std::vector<kv_str_t> &dkeys,
+                                            const std::vector<kv_str_t> &dvals,
+                                            const std::vector<rank_col_t> &dcols,
+                                            int nthreads,
+                                            const std::vector<uint64_t> *evicted)
+{
+  std::vector<uint64_t> base_evicted;
+  if (evicted == NULL) {
+    if (base != NULL) {
+      base_evicted.assign (base->m_evicted,
+                           base->m_evicted + base->evicted_count ());
+    }
+    evicted = &base_evicted;
+  }
+  std::vector<kv_str_t> keys;
+  std::vector<kv_str_t> vals;
+  kv_str_less_t less;
+  uint64_t data_size = 0;
+
+  /* equal values (of at least MAP_WRAP_INTERN_MIN bytes) are stored once:
+   * canon records, in the order values are laid out below, the first of
+   * the values equal to each */
+  kv_intern_t distinct;
+  std::vector<const char *> canon;
+  auto value_size = [&] (kv_str_t v, uint64_t h) -> uint64_t {
+    if (v.len < MAP_WRAP_INTERN_MIN) {
+      return v.len + 1;
+    }
+    const kv_str_t *first = distinct.find (v.ptr, v.len, h);
+    if (first != NULL) {
+      canon.push_back (first->ptr);
+      return 0;
+    }
+    distinct.add (v, h);
+    canon.push_back (v.ptr);
+    return v.len + 1;
+  };
+
+  /* merge base (in key order) with delta; delta wins on equal keys */
+  size_t i = 0;
+  size_t j = 0;
+  size_t nbase = base ? base->count () : 0;
+  keys.reserve (nbase + dkeys.size ());
+  vals.reserve (nbase + dkeys.size ());
+  while (i < nbase || j < dkeys.size ()) {
+    if (j == dkeys.size ()
+        || (i < nbase && less (base->key (base->slot_in_order (i)),
+                               dkeys[j]))) {
+      const kvs_slot_t *s = base->slot_in_order (i++);
+      keys.push_back (base->key (s));
+      vals.push_back (base->value (s));
+    } else {
+      if (i < nbase && !less (dkeys[j], base->key (base->slot_in_order (i)))) {
+        i++;
+      }
+      keys.push_back (dkeys[j]);
+      vals.push_back (dvals[j]);
+      j++;
+    }
+  }
+
+  /* columns: those of base, updated by delta, then any new in delta */
+  std::vector<col_src_t> cols;
+  uint64_t ncolvals = 0;
+  size_t nbase_cols = base ? base->col_count () : 0;
+  for (size_t c = 0; c < nbase_cols; c++) {
+    const kvs_col_t *bc = base->col (c);
+    col_src_t src;
+    src.prefix.ptr = base->m_data + bc->prefix_off;
+    src.prefix.len = bc->prefix_len;
+    src.suffix.ptr = base->m_data + bc->suffix_off;
+    src.suffix.len = bc->suffix_len;
+    src.base = base;
+    src.base_col = c;
+    src.delta = NULL;
+    src.nranks = bc->nranks;
+    cols.push_back (src);
+  }
+  std::vector<rank_col_t>::const_iterator dc;
+  for (dc = dcols.begin (); dc != dcols.end (); dc++) {
+    size_t c;
+    for (c = 0; c < cols.size (); c++) {
+      if (cols[c].prefix.len == dc->prefix.size ()
+          && cols[c].suffix.len == dc->suffix.size ()
+          && memcmp (cols[c].prefix.ptr, dc->prefix.data (),
+                     dc->prefix.size ()) == 0
+          && memcmp (cols[c].suffix.ptr, dc->suffix.data (),
+                     dc->suffix.size ()) == 0) {
+        break;
+      }
+    }
+    if (c == cols.size ()) {
+      if (dc->nset == 0) {
+        continue;
+      }
+      col_src_t src;
+      src.prefix.ptr = dc->prefix.data ();
+      src.prefix.len = dc->prefix.size ();
+      src.suffix.ptr = dc->suffix.data ();
+      src.suffix.len = dc->suffix.size ();
+      src.base = NULL;
+      src.base_col = 0;
+      src.nranks = 0;
+      cols.push_back (src);
+    }
+    cols[c].delta = &*dc;
+    if (dc->vals.size () > cols[c].nranks) {
+      cols[c].nranks = dc->vals.size ();
+    }
+  }
+  std::vector<kv_str_t> colvals;
+  for (size_t c = 0; c < cols.size (); c++) {
+    data_size += cols[c].prefix.len + 1 + cols[c].suffix.len + 1;
+    ncolvals += cols[c].nranks;
+    for (uint64_t r = 0; r < cols[c].nranks; r++) {
+      kv_str_t v = { NULL, 0 };
+      col_src_value (cols[c], r, &v);
+      colvals.push_back (v);
+    }
+  }
+
+  /* hash keys and (interned) values up front, in parallel */
+  uint64_t n = keys.size ();
+  std::vector<uint64_t> hashes (n);
+  std::vector<uint64_t> val_hashes (n + ncolvals);
+  if (n + ncolvals < 4096) {
+    nthreads = 1;
+  }
+  parallel_range (nthreads, n + ncolvals, [&] (size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      const kv_str_t &v = k < n ? vals[k] : colvals[k - n];
+      if (k < n) {
+        hashes[k] = hash (keys[k].ptr, keys[k].len);
+      }
+      if (v.ptr != NULL && v.len >= MAP_WRAP_INTERN_MIN) {
+        val_hashes[k] = kv_hash (v.ptr, v.len);
+      }
+    }
+  });
+  for (uint64_t k = 0; k < n; k++) {
+    data_size += keys[k].len + 1 + value_size (vals[k], val_hashes[k]);
+  }
+  for (uint64_t k = 0; k < ncolvals; k++) {
+    if (colvals[k].ptr != NULL && colvals[k].ptr != col_evicted_mark) {
+      data_size += value_size (colvals[k], val_hashes[n + k]);
+    }
+  }
+
+  kvs_snapshot_hdr_t hdr;
+  hdr.magic = KVS_SNAPSHOT_MAGIC;
+  hdr.nslots = n;
+  hdr.bloom_off = (sizeof (hdr) + 63) & ~63ULL;
+  hdr.nevicted = evicted->size ();
+  hdr.bloom_blocks = ((n + hdr.nevicted) * KVS_BLOOM_BITS_PER_KEY
+                      + KVS_BLOOM_BLOCK_BITS - 1) / KVS_BLOOM_BLOCK_BITS;
+  hdr.disp_off = hdr.bloom_off + hdr.bloom_blocks * 64;
+  hdr.slots_off = align8 (hdr.disp_off + n * sizeof (int32_t));
+  hdr.order_off = hdr.slots_off + n * sizeof (kvs_slot_t);
+  hdr.evicted_off = align8 (hdr.order_off + n * sizeof (uint32_t));
+  hdr.ncols = cols.size ();
+  hdr.cols_off = hdr.evicted_off + hdr.nevicted * sizeof (uint64_t);
+  hdr.data_off = hdr.cols_off + hdr.ncols * sizeof (kvs_col_t)
+                 + ncolvals * sizeof (kvs_col_val_t);
+  hdr.size = hdr.data_off + data_size;
+
+  /* cache line aligned so that each bloom block is one line */
+  char *image = NULL;
+  if (posix_memalign ((void **) &image, 64, hdr.size) != 0) {
+    return NULL;
+  }
+  memcpy (image, &hdr, sizeof (hdr));
+  memset (image + hdr.bloom_off, 0, hdr.bloom_blocks * 64);
+
+  int32_t *disp = (int32_t *)(image + hdr.disp_off);
+  kvs_slot_t *slots = (kvs_slot_t *)(image + hdr.slots_off);
+  uint32_t *order = (uint32_t *)(image + hdr.order_off);
+  char *data = image + hdr.data_off;
+
+  uint64_t *bloom = (uint64_t *)(image + hdr.bloom_off);
+  for (uint64_t k = 0; k < n; k++) {
+    bloom_add (bloom, hdr.bloom_blocks, hashes[k]);
+  }
+  for (uint64_t k = 0; k < hdr.nevicted; k++) {
+    bloom_add (bloom, hdr.bloom_blocks, (*evicted)[k]);
+  }
+  if (hdr.nevicted > 0) {
+    memcpy (image + hdr.evicted_off, evicted->data (),
+            hdr.nevicted * sizeof (uint64_t));
+  }
+  if (!place (hashes, disp, order)) {
+    free (image);
+    return NULL;
+  }
+
+  /* lay the bytes out in key order; the slots point into them */
+  char *p = data;
+  kv_ref_ids_t ids;
+  std::vector<uint64_t> offs;
+  size_t next_canon = 0;
+  ids.reset (distinct.size ());
+  offs.reserve (distinct.size ());
+  auto put_value = [&] (kv_str_t v) -> uint64_t {
+    if (v.len >= MAP_WRAP_INTERN_MIN) {
+      int64_t id = ids.seen (canon[next_canon++]);
+      if (id >= 0) {
+        return offs[id];
+      }
+      offs.push_back (p - data);
+    }
+    uint64_t here = p - data;
+    memcpy (p, v.ptr, v.len);
+    p += v.len;
+    *p++ = '\0';
+    return here;
+  };
+  for (uint64_t k = 0; k < n; k++) {
+    kvs_slot_t *s = &slots[order[k]];
+    s->hash = hashes[k];
+    s->key_off = p - data;
+    s->key_len = keys[k].len;
+    memcpy (p, keys[k].ptr, keys[k].len);
+    p += keys[k].len;
+    *p++ = '\0';
+    s->val_off = put_value (vals[k]);
+    s->val_len = vals[k].len;
+  }
+
+  kvs_col_t *col = (kvs_col_t *)(image + hdr.cols_off);
+  kvs_col_val_t *cv = (kvs_col_val_t *)(col + hdr.ncols);
+  size_t next_colval = 0;
+  for (size_t c = 0; c < cols.size (); c++, col++) {
+    col->prefix_off = p - data;
+    col->prefix_len = cols[c].prefix.len;
+    memcpy (p, cols[c].prefix.ptr, cols[c].prefix.len);
+    p += cols[c].prefix.len;
+    *p++ = '\0';
+    col->suffix_off = p - data;
+    col->suffix_len = cols[c].suffix.len;
+    memcpy (p, cols[c].suffix.ptr, cols[c].suffix.len);
+    p += cols[c].suffix.len;
+    *p++ = '\0';
+    col->nranks = cols[c].nranks;
+    col->vals_off = (char *) cv - (image + hdr.cols_off);
+    for (uint64_t r = 0; r < cols[c].nranks; r++, cv++) {
+      const kv_str_t &v = colvals[next_colval++];
+      cv->set = v.ptr == col_evicted_mark ? KVS_COL_EVICTED
+                : v.ptr != NULL ? KVS_COL_SET : 0;
+      cv->off = 0;
+      cv->len = 0;
+      if (cv->set == KVS_COL_SET) {
+        cv->off = put_value (v);
+        cv->len = v.len;
+      }
+    }
+  }
+  return new kvs_snapshot_t (image);
+}
+
+uint64_t kvs_snapshot_t::checksum () const
+{
+  /* the cols, col_vals and bytes sections run to the end with no gaps */
+  return kv_mix64 (kv_hash (m_image + m_hdr->cols_off,
+                            m_hdr->size - m_hdr->cols_off) + m_hdr->nslots);
+}
+
+bool kvs_snapshot_t::may_contain (uint64_t h) const
+{
+  if (m_hdr->bloom_blocks == 0) {
+    return false;
+  }
+  const uint64_t *block = bloom_block (m_bloom, m_hdr->bloom_blocks, h);
+  uint64_t bits = kv_mix64 (h);
+  for (int i = 0; i < KVS_BLOOM_HASHES; i++, bits >>= 9) {
+    if (!(block[(bits & 511) >> 6] & (1ULL << (bits & 63)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double kvs_snapshot_t::bloom_fpr () const
+{
+  /* standard estimate, ignoring the (small) penalty of blocking */
+  double m = (double) m_hdr->bloom_blocks * KVS_BLOOM_BLOCK_BITS;
+  if (m == 0) {
+    return 0.0;
+  }
+  double fill = 1.0 - exp (-(double) KVS_BLOOM_HASHES
+                          * (m_hdr->nslots + m_hdr->nevicted) / m);
+  return pow (fill, KVS_BLOOM_HASHES);
+}
+
+const kvs_slot_t *kvs_snapshot_t::lookup (const char *key, size_t len,
+                                          uint64_t h) const
+{
+  uint64_t n = m_hdr->nslots;
+  if (n == 0) {
+    return NULL;
+  }
+
+  int32_t d = m_disp[h % n];
+  if (d == 0) {
+    return NULL;
+  }
+  const kvs_slot_t *s = &m_slots[d < 0 ? (uint64_t)(-(int64_t) d - 1)
+                                       : displace (h, d, n)];
+  if (s->hash != h || s->key_len != len
+      || memcmp (m_data + s->key_off, key, len) != 0) {
+    return NULL;
+  }
+  return s;
+}
+
+int kvs_snapshot_t::match_col (const char *key, size_t len, int *rank) const
+{
+  for (size_t c = 0; c < m_hdr->ncols; c++) {
+    const kvs_col_t *col = &m_cols[c];
+    if (rank_key_match (m_data + col->prefix_off, col->prefix_len,
+                        m_data + col->suffix_off, col->suffix_len,
+                        key, len, col->nranks, rank)) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+bool kvs_snapshot_t::col_value (size_t i, int rank, kv_str_t *out) const
+{
+  const kvs_col_t *col = &m_cols[i];
+  if (rank < 0 || (uint64_t) rank >= col->nranks) {
+    return false;
+  }
+  const kvs_col_val_t *cv = (const kvs_col_val_t *)
+    ((const char *) m_cols + col->vals_off) + rank;
+  if (cv->set != KVS_COL_SET) {
+    return false;
+  }
+  out->ptr = m_data + cv->off;
+  out->len = cv->len;
+  return true;
+}
+
+bool kvs_snapshot_t::col_evicted (size_t i, int rank) const
+{
+  const kvs_col_t *col = &m_cols[i];
+  if (rank < 0 || (uint64_t) rank >= col->nranks) {
+    return false;
+  }
+  const kvs_col_val_t *cv = (const kvs_col_val_t *)
+    ((const char *) m_cols + col->vals_off) + rank;
+  return cv->set == KVS_COL_EVICTED;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,200 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * kvs_snapshot.hpp
+ *
+ * Read-only view of the KVS published by a fence. The whole snapshot is
+ * one position-independent image:
+ *
+ *   header | bloom | disp | slots | order | evicted | cols | col_vals | bytes
+ *
+ * slots are placed by a minimal perfect hash (hash and displace): the
+ * 64-bit hash of a key selects a bucket, whose displacement either names
+ * the slot directly or is mixed into the hash to find it. A lookup is
+ * therefore one pass over the key, two array reads and a memcmp.
+ * order lists the slots in key order so that a snapshot can be merged
+ * with the next fence's entries in a single linear pass.
+ *
+ * Misses are usually settled by the bloom filter alone: a blocked filter
+ * of 512-bit blocks, so a negative answer costs one cache line and never
+ * touches the slots. A snapshot trimmed to a memory budget keeps the
+ * hashes of the keys it left out (evicted), and its filter covers them
+ * too, so that it still tells which keys exist anywhere; the template
+ * values it left out are marked as such.
+ *
+ * Keys registered as rank templates are not hashed at all: each template
+ * has a column of per-rank value references (col_vals), indexed directly
+ * by the rank parsed out of the key.
+ *
+ * Equal values are stored once in bytes, with every slot or col_val that
+ * holds them pointing at the same copy.
+ *
+ * Hashing, the bulk of a build, is spread over the delta's decode threads.
+ *
+ * Being position independent, the image can be saved to a file as is and
+ * mapped back read-only by a later job step, which then shares the pages
+ * with every other process of the node that maps the same file.
+ */
+
+#ifndef KVS_SNAPSHOT_HPP
+#define KVS_SNAPSHOT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "map_wrap.hpp"
+
+#define KVS_SNAPSHOT_MAGIC 0x34706e73696d70ULL /* "pmisnp4" */
+#define KVS_BLOOM_BLOCK_BITS 512
+#define KVS_BLOOM_BITS_PER_KEY 10
+#define KVS_BLOOM_HASHES 7
+
+struct kvs_slot_t {
+  uint64_t hash;
+  uint64_t key_off;
+  uint64_t val_off;
+  uint32_t key_len;
+  uint32_t val_len;
+};
+
+struct kvs_col_t {
+  uint64_t prefix_off;
+  uint64_t suffix_off;
+  uint32_t prefix_len;
+  uint32_t suffix_len;
+  uint64_t nranks;
+  uint64_t vals_off;
+};
+
+/* set: whether the value is here */
+#define KVS_COL_SET 1
+#define KVS_COL_EVICTED 2
+
+struct kvs_col_val_t {
+  uint64_t off;
+  uint32_t len;
+  uint32_t set;
+};
+
+struct kvs_snapshot_hdr_t {
+  uint64_t magic;
+  uint64_t size;
+  uint64_t nslots;
+  uint64_t bloom_off;
+  uint64_t bloom_blocks;
+  uint64_t disp_off;
+  uint64_t slots_off;
+  uint64_t order_off;
+  uint64_t nevicted;
+  uint64_t evicted_off;
+  uint64_t ncols;
+  uint64_t cols_off;
+  uint64_t data_off;
+};
+
+typedef std::function<bool (const kvs_slot_t *)> kvs_slot_filter_t;
+
+class kvs_snapshot_t {
+public:
+  ~kvs_snapshot_t ();
+
+  /* entries of delta replace those of base (which may be NULL) */
+  static kvs_snapshot_t *build (const kvs_snapshot_t *base,
+                                const map_wrap_t &delta);
+  static uint64_t hash (const char *key, size_t len);
+  /* snap without the slots keep rejects or the column values of ranks
+   * other than rank, but with a filter that still has them; evicted
+   * counts what was left out */
+  static kvs_snapshot_t *subset (const kvs_snapshot_t *snap,
+                                 kvs_slot_filter_t keep,
+                                 int rank, size_t *evicted);
+
+  /* write the image to path (atomically, through a temporary file) */
+  bool save (const char *path) const;
+  /* map an image written by save (); NULL if there is none or it does
+   * not look like one */
+  static kvs_snapshot_t *load (const char *path);
+  /* of the keys, values and columns, which builds from the same entries
+   * lay out alike */
+  uint64_t checksum () const;
+
+  bool may_contain (uint64_t h) const;
+  const kvs_slot_t *lookup (const char *key, size_t len, uint64_t h) const;
+  const kvs_slot_t *lookup (const char *key, size_t len) const
+  {
+    uint64_t h = hash (key, len);
+    return may_contain (h) ? lookup (key, len, h) : NULL;
+  }
+
+  size_t count () const { return m_hdr->nslots; }
+  size_t evicted_count () const { return m_hdr->nevicted; }
+  size_t image_size () const { return m_hdr->size; }
+  size_t bloom_bytes () const { return m_hdr->bloom_blocks * 64; }
+  double bloom_fpr () const;
+  const kvs_slot_t *slot_in_order (size_t i) const
+  {
+    return &m_slots[m_order[i]];
+  }
+  kv_str_t key (const kvs_slot_t *s) const
+  {
+    kv_str_t k = { m_data + s->key_off, s->key_len };
+    return k;
+  }
+  kv_str_t value (const kvs_slot_t *s) const
+  {
+    kv_str_t v = { m_data + s->val_off, s->val_len };
+    return v;
+  }
+
+  kv_str_t string_at (uint64_t off, uint32_t len) const
+  {
+    kv_str_t s = { m_data + off, len };
+    return s;
+  }
+
+  size_t col_count () const { return m_hdr->ncols; }
+  const kvs_col_t *col (size_t i) const { return &m_cols[i]; }
+  int match_col (const char *key, size_t len, int *rank) const;
+  bool col_value (size_t i, int rank, kv_str_t *out) const;
+  /* the value is set, but was left out by subset () */
+  bool col_evicted (size_t i, int rank) const;
+
+private:
+  static kvs_snapshot_t *build_from (const kvs_snapshot_t *base,
+                                     const std::vector<kv_str_t> &dkeys,
+                                     const std::vector<kv_str_t> &dvals,
+                                     const std::vector<rank_col_t> &dcols,
+                                     int nthreads,
+                                     const std::vector<uint64_t> *evicted
+                                     = NULL);
+
+  kvs_snapshot_t (char *image, size_t mapped = 0);
+  kvs_snapshot_t (const kvs_snapshot_t &);
+  kvs_snapshot_t &operator= (const kvs_snapshot_t &);
+
+  char *m_image;
+  /* size of the mapping m_image comes from, 0 if it was malloc'd */
+  size_t m_mapped;
+  const kvs_snapshot_hdr_t *m_hdr;
+  const uint64_t *m_bloom;
+  const int32_t *m_disp;
+  const kvs_slot_t *m_slots;
+  const uint32_t *m_order;
+  const uint64_t *m_evicted;
+  const kvs_col_t *m_cols;
+  const char *m_data;
+};
+
+#endif // KVS_SNAPSHOT_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,778 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <limits.h>
+#include <stdio.h>
+#include <chrono>
+#include "kvs_space.hpp"
+
+/* spaces are numbered for the per-thread stage cache below */
+static std::atomic<int> next_id (0);
+
+/* the calling thread's stage of each space, by space id; a stage outlives
+ * its thread (staged puts still go out with the next commit) and is
+ * handed to the next thread that puts to the space */
+struct kvs_stage_cache_t {
+  std::vector<kvs_stage_t *> stages;
+  ~kvs_stage_cache_t ()
+  {
+    for (size_t i = 0; i < stages.size (); i++) {
+      if (stages[i] != NULL) {
+        stages[i]->owned = false;
+      }
+    }
+  }
+};
+static thread_local kvs_stage_cache_t my_stages;
+
+kvs_space_t::kvs_space_t (const char *name)
+  : m_stats (NULL), m_id (next_id++), m_comm (MPI_COMM_NULL), m_rank (-1),
+    m_size (0), m_dirty (false), m_global (NULL), m_open (false),
+    m_sources (MPI_COMM_NULL), m_restored (false), m_pending (NULL),
+    m_uniform (true),
+    m_budget (0), m_fetch_comm (NULL), m_index (0), m_epoch (0),
+    m_trimmed (false), m_fetched_bytes (0), m_fetched_gen (0)
+{
+  snprintf (m_name, sizeof (m_name), "%s", name);
+  for (int i = 0; i < KVS_SPACE_HOT_KEYS; i++) {
+    m_hot[i] = 0;
+  }
+}
+
+bool kvs_space_t::open ()
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  if (MPI_Comm_dup (MPI_COMM_WORLD, &m_comm) != MPI_SUCCESS
+      || MPI_Comm_rank (m_comm, &m_rank) != MPI_SUCCESS
+      || MPI_Comm_size (m_comm, &m_size) != MPI_SUCCESS) {
+    return false;
+  }
+  m_commit.m_comm = &m_comm;
+  m_open = true;
+  return true;
+}
+
+void kvs_space_t::close ()
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  if (!m_open) {
+    return;
+  }
+  m_open = false;
+  {
+    std::lock_guard<std::mutex> stages_guard (m_stages_lock);
+    for (size_t i = 0; i < m_stages.size (); i++) {
+      std::lock_guard<std::mutex> stage_guard (m_stages[i]->lock);
+      m_stages[i]->log.release ();
+    }
+  }
+  m_commit.release ();
+  m_dirty = false;
+
+  /* both stores live in their own arenas, so teardown is a free per chunk
+   * rather than one per key and value */
+  kvs_snapshot_t *snap = m_global.load ();
+  m_global = NULL;
+  rcu_synchronize ();
+  delete snap;
+  delete m_pending;
+  m_pending = NULL;
+
+  std::map<std::vector<int>, MPI_Comm>::iterator g;
+  for (g = m_groups.begin (); g != m_groups.end (); g++) {
+    MPI_Comm_free (&g->second);
+  }
+  m_groups.clear ();
+  if (m_sources != MPI_COMM_NULL) {
+    MPI_Comm_free (&m_sources);
+  }
+  MPI_Comm_free (&m_comm);
+}
+
+bool kvs_space_t::reopen (const char *name)
+{
+  {
+    std::lock_guard<std::mutex> guard (m_lock);
+    if (m_open) {
+      return false;
+    }
+    snprintf (m_name, sizeof (m_name), "%s", name);
+    m_outbox.clear ();
+    m_attrs.clear ();
+    m_restored = false;
+    m_uniform = true;
+    m_epoch = 0;
+    m_trimmed = false;
+    for (int i = 0; i < KVS_SPACE_HOT_KEYS; i++) {
+      m_hot[i] = 0;
+    }
+    std::lock_guard<std::mutex> fetched_guard (m_fetched_lock);
+    m_fetched.clear ();
+    m_missing.clear ();
+    m_fetched_bytes = 0;
+    m_fetched_gen++;
+  }
+  return open ();
+}
+
+kvs_stage_t *kvs_space_t::thread_stage ()
+{
+  if (my_stages.stages.size () <= (size_t) m_id) {
+    my_stages.stages.resize (m_id + 1, NULL);
+  }
+  kvs_stage_t *&mine = my_stages.stages[m_id];
+  if (mine == NULL) {
+    std::lock_guard<std::mutex> guard (m_stages_lock);
+    for (size_t i = 0; i < m_stages.size () && mine == NULL; i++) {
+      bool expected = false;
+      if (m_stages[i]->owned.compare_exchange_strong (expected, true)) {
+        mine = m_stages[i];
+      }
+    }
+    if (mine == NULL) {
+      kvs_stage_t *stage = new kvs_stage_t;
+      stage->owned = true;
+      m_stages.push_back (stage);
+      mine = stage;
+    }
+  }
+  return mine;
+}
+
+/* append to this thread's stage; a later put of the same key wins at
+ * commit */
+bool kvs_space_t::put (const char *key, size_t key_len,
+                       const char *value, size_t value_len)
+{
+  kvs_stage_t *stage = thread_stage ();
+  std::lock_guard<std::mutex> guard (stage->lock);
+  return stage->log.append (key, key_len, value, value_len);
+}
+
+/* values for particular ranks bypass the stages and commit: they are
+ * only seen by their targets, after the next fence of the space */
+int kvs_space_t::put_to (const char *key, size_t key_len,
+                         const char *value, size_t value_len,
+                         const std::vector<int> &dests)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  try {
+    for (size_t i = 0; i < dests.size (); i++) {
+      map_wrap_append_pair (m_outbox[dests[i]], key, key_len,
+                            value, value_len);
+    }
+  } catch (const std::bad_alloc &) {
+    return PMI_ERR_NOMEM;
+  }
+  return PMI_SUCCESS;
+}
+
+int kvs_space_t::commit ()
+{
+  /* sort each stage once and merge it in key order into commit,
+   * overwriting existing entries */
+  std::lock_guard<std::mutex> guard (m_lock);
+  std::lock_guard<std::mutex> stages_guard (m_stages_lock);
+  for (size_t i = 0; i < m_stages.size (); i++) {
+    std::lock_guard<std::mutex> stage_guard (m_stages[i]->lock);
+    put_log_t &put = m_stages[i]->log;
+    if (put.empty ()) {
+      continue;
+    }
+    put.sort ();
+    m_dirty = true;
+    if (put.merge_into (m_commit) != 0) {
+      return PMI_ERR_NOMEM;
+    }
+
+    /* clear put */
+    put.clear ();
+  }
+  return PMI_SUCCESS;
+}
+
+void kvs_space_t::register_rank_key (const char *prefix, size_t prefix_len,
+                                     const char *suffix, size_t suffix_len)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  m_commit.register_rank_key (prefix, prefix_len, suffix, suffix_len);
+}
+
+/*
+ * Exchange everything committed since the last fence over comm, leaving
+ * the union in m_commit. Without MPI_THREAD_MULTIPLE, mpi_lock keeps
+ * fences of different spaces from calling MPI at the same time.
+ */
+int kvs_space_t::exchange (MPI_Comm *comm, std::mutex *mpi_lock,
+                           bool targeted)
+{
+  std::unique_lock<std::mutex> mpi_guard;
+  if (mpi_lock != NULL) {
+    mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+  }
+
+  /* every rank gathers all the others' images and merges them itself,
+   * so none holds more than the images plus the snapshot they become */
+  m_commit.m_comm = comm;
+  m_commit.m_flags = targeted && !m_outbox.empty () ? MAP_WRAP_FLAG_TARGETED
+                                                     : 0;
+  int rc = m_commit.allgather () == 0 ? PMI_SUCCESS : PMI_FAIL;
+  m_commit.m_comm = &m_comm;
+
+  /* the flag came back set everywhere if anyone has targeted values */
+  if (rc == PMI_SUCCESS && (m_commit.m_flags & MAP_WRAP_FLAG_TARGETED)) {
+    rc = deliver ();
+  }
+
+  /* size of the broadcast image, with repeated values sent once */
+  if (rc == PMI_SUCCESS && m_stats) {
+    m_stats->wire_bytes += m_commit.m_image_size;
+  }
+  return rc;
+}
+
+/*
+ * Route the outbox to its targets over m_comm and merge what arrives
+ * into m_commit. Counts are ints, so what one rank sends, or receives,
+ * in a fence must stay under 2GB.
+ */
+int kvs_space_t::deliver ()
+{
+  std::vector<int> scounts (m_size, 0), sdispls (m_size, 0);
+  std::vector<int> rcounts (m_size), rdispls (m_size);
+  std::string sbuf;
+  std::map<int, std::string>::iterator o;
+  for (o = m_outbox.begin (); o != m_outbox.end (); o++) {
+    if (sbuf.size () + o->second.size () > INT_MAX) {
+      return PMI_FAIL;
+    }
+    sdispls[o->first] = sbuf.size ();
+    scounts[o->first] = o->second.size ();
+    sbuf += o->second;
+  }
+  m_outbox.clear ();
+  m_uniform = false;
+
+  if (MPI_Alltoall (scounts.data (), 1, MPI_INT, rcounts.data (), 1, MPI_INT,
+                    m_comm) != MPI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  size_t total = 0;
+  for (int r = 0; r < m_size; r++) {
+    rdispls[r] = total;
+    if ( (total += rcounts[r]) > INT_MAX) {
+      return PMI_FAIL;
+    }
+  }
+  std::vector<char> rbuf (total + 1);
+  if (MPI_Alltoallv (&sbuf[0], scounts.data (), sdispls.data (), MPI_CHAR,
+                     rbuf.data (), rcounts.data (), rdispls.data (), MPI_CHAR,
+                     m_comm) != MPI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  if (m_stats) {
+    m_stats->wire_bytes += total;
+  }
+  return m_commit.unpack (rbuf.data (), total) == total ? PMI_SUCCESS
+                                                        : PMI_FAIL;
+}
+
+/* fold m_commit into a new read-only snapshot and start the next epoch
+ * empty. Readers may still be in the old snapshot, which goes once they
+ * are out; those that wait on m_lock for commit see the new one */
+int kvs_space_t::publish ()
+{
+  kvs_snapshot_t *old = m_global.load ();
+  kvs_snapshot_t *snap;
+  if ( (snap = kvs_snapshot_t::build (old, m_commit)) == NULL) {
+    return PMI_FAIL;
+  }
+  trim (&snap);
+  m_global = snap;
+  m_commit.clear ();
+  m_dirty = false;
+  {
+    std::lock_guard<std::mutex> guard (m_fetched_lock);
+    m_fetched.clear ();
+    m_missing.clear ();
+    m_fetched_bytes = 0;
+    m_fetched_gen++;
+  }
+  rcu_synchronize ();
+  delete old;
+  if (m_stats) {
+    m_stats->fences++;
+  }
+  return PMI_SUCCESS;
+}
+
+/* true if commit holds nothing snap does not have already */
+bool kvs_space_t::redundant (const kvs_snapshot_t *snap)
+{
+  if (snap == NULL || !m_outbox.empty ()) {
+    return false;
+  }
+
+  kv_map_t::const_iterator i;
+  for (i = m_commit.m_map.begin (); i != m_commit.m_map.end (); i++) {
+    const kvs_slot_t *slot = snap->lookup (i->first.ptr, i->first.len);
+    if (slot == NULL
+        || !kv_str_equal_t () (snap->value (slot), i->second)) {
+      return false;
+    }
+  }
+
+  std::vector<rank_col_t>::const_iterator c;
+  for (c = m_commit.m_cols.begin (); c != m_commit.m_cols.end (); c++) {
+    if (c->nset == 0) {
+      continue;
+    }
+    size_t s = 0;
+    while (s < snap->col_count ()) {
+      const kvs_col_t *col = snap->col (s);
+      kv_str_t prefix = snap->string_at (col->prefix_off, col->prefix_len);
+      kv_str_t suffix = snap->string_at (col->suffix_off, col->suffix_len);
+      if (prefix.len == c->prefix.size () && suffix.len == c->suffix.size ()
+          && memcmp (prefix.ptr, c->prefix.data (), prefix.len) == 0
+          && memcmp (suffix.ptr, c->suffix.data (), suffix.len) == 0) {
+        break;
+      }
+      s++;
+    }
+    if (s == snap->col_count ()) {
+      return false;
+    }
+    for (size_t r = 0; r < c->vals.size (); r++) {
+      kv_str_t have;
+      if (c->vals[r].ptr != NULL
+          && (!snap->col_value (s, r, &have)
+              || !kv_str_equal_t () (have, c->vals[r]))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int kvs_space_t::fence (std::mutex *mpi_lock)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+
+  /* a restored snapshot usually has all this step's values already */
+  if (m_restored) {
+    int mine = redundant (m_pending != NULL ? m_pending : m_global.load ())
+               ? 1 : 0;
+    int all = 0;
+    {
+      std::unique_lock<std::mutex> mpi_guard;
+      if (mpi_lock != NULL) {
+        mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+      }
+      if (MPI_Allreduce (&mine, &all, 1, MPI_INT, MPI_MIN, m_comm)
+          != MPI_SUCCESS) {
+        return PMI_FAIL;
+      }
+    }
+    if (all) {
+      if (m_pending != NULL) {
+        /* nothing was published before, so no reader can hold it */
+        m_global = m_pending;
+        m_pending = NULL;
+      }
+      m_commit.clear ();
+      m_dirty = false;
+      m_epoch++;
+      if (m_stats) {
+        m_stats->fences++;
+      }
+      return PMI_SUCCESS;
+    }
+    /* keys of the earlier step that this one did not put again must
+     * not show, so an unpublished snapshot is not built upon */
+    m_restored = false;
+    delete m_pending;
+    m_pending = NULL;
+  }
+
+  if (exchange (&m_comm, mpi_lock, true) != PMI_SUCCESS
+      || publish () != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  m_epoch.fetch_add (1, std::memory_order_release);
+  return PMI_SUCCESS;
+}
+
+int kvs_space_t::fence_group (const std::vector<int> &ranks,
+                              std::mutex *mpi_lock)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  m_uniform = false;
+  /* the members' values would be lost if the next full fence published
+   * the restored snapshot */
+  delete m_pending;
+  m_pending = NULL;
+
+  /* MPI_Comm_create_group only involves the members, unlike
+   * MPI_Comm_create */
+  std::map<std::vector<int>, MPI_Comm>::iterator g = m_groups.find (ranks);
+  if (g == m_groups.end ()) {
+    std::unique_lock<std::mutex> mpi_guard;
+    if (mpi_lock != NULL) {
+      mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+    }
+    MPI_Group all, members;
+    MPI_Comm comm;
+    if (MPI_Comm_group (m_comm, &all) != MPI_SUCCESS) {
+      return PMI_FAIL;
+    }
+    int rc = MPI_Group_incl (all, ranks.size (), ranks.data (), &members);
+    MPI_Group_free (&all);
+    if (rc != MPI_SUCCESS) {
+      return PMI_FAIL;
+    }
+    rc = MPI_Comm_create_group (m_comm, members, KVS_SPACE_GROUP_TAG, &comm);
+    MPI_Group_free (&members);
+    if (rc != MPI_SUCCESS) {
+      return PMI_FAIL;
+    }
+    g = m_groups.insert (std::make_pair (ranks, comm)).first;
+  }
+
+  if (exchange (&g->second, mpi_lock, false) != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  return publish ();
+}
+
+/*
+ * Replace the graph used by sparse fences with one holding an edge from
+ * each of sources to this rank. MPI_Dist_graph_create lets every rank
+ * name only its incoming edges and works out the outgoing ones.
+ */
+int kvs_space_t::set_sources (const std::vector<int> &sources,
+                              std::mutex *mpi_lock)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  std::unique_lock<std::mutex> mpi_guard;
+  if (mpi_lock != NULL) {
+    mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+  }
+
+  std::vector<int> degrees (sources.size (), 1);
+  std::vector<int> dests (sources.size (), m_rank);
+  MPI_Comm graph;
+  if (MPI_Dist_graph_create (m_comm, sources.size (), sources.data (),
+                             degrees.data (), dests.data (), MPI_UNWEIGHTED,
+                             MPI_INFO_NULL, 0, &graph) != MPI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  if (m_sources != MPI_COMM_NULL) {
+    MPI_Comm_free (&m_sources);
+  }
+  m_sources = graph;
+  return PMI_SUCCESS;
+}
+
+int kvs_space_t::fence_sparse (std::mutex *mpi_lock)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  if (m_sources == MPI_COMM_NULL) {
+    return PMI_FAIL;
+  }
+  m_uniform = false;
+  delete m_pending;
+  m_pending = NULL;
+
+  std::unique_lock<std::mutex> mpi_guard;
+  if (mpi_lock != NULL) {
+    mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+  }
+  m_commit.m_comm = &m_sources;
+  int rc = m_commit.neighbor_exchange () == 0 ? PMI_SUCCESS : PMI_FAIL;
+  m_commit.m_comm = &m_comm;
+  if (mpi_guard.owns_lock ()) {
+    mpi_guard.unlock ();
+  }
+  if (rc != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+  if (m_stats) {
+    m_stats->wire_bytes += m_commit.m_image_size;
+  }
+  return publish ();
+}
+
+bool kvs_space_t::restore (const char *path, std::mutex *mpi_lock)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  kvs_snapshot_t *snap = m_global.load () == NULL && m_pending == NULL
+                         ? kvs_snapshot_t::load (path) : NULL;
+
+  /* nodes may hold files of different earlier steps: the minimum of the
+   * checksum and of its complement tell whether all are the same */
+  uint64_t sum = snap != NULL ? snap->checksum () : 0;
+  uint64_t mine[3] = { snap != NULL ? 1ULL : 0ULL, sum, ~sum };
+  uint64_t all[3] = { 0, 0, 0 };
+  {
+    std::unique_lock<std::mutex> mpi_guard;
+    if (mpi_lock != NULL) {
+      mpi_guard = std::unique_lock<std::mutex> (*mpi_lock);
+    }
+    if (MPI_Allreduce (mine, all, 3, MPI_UINT64_T, MPI_MIN, m_comm)
+        != MPI_SUCCESS) {
+      all[0] = 0;
+    }
+  }
+  if (all[0] == 0 || all[1] != ~all[2]) {
+    delete snap;
+    return false;
+  }
+  m_pending = snap;
+  m_restored = true;
+  return true;
+}
+
+bool kvs_space_t::persist (const char *path)
+{
+  std::lock_guard<std::mutex> guard (m_lock);
+  kvs_snapshot_t *snap = m_global.load ();
+  return m_uniform && !m_trimmed && snap != NULL && snap->save (path);
+}
+
+/*
+ * Trim a new snapshot that is over budget. Only snapshots that are the
+ * same everywhere are trimmed, since the homes of entries answer from
+ * their own. The snapshot is built whole first, so the budget bounds
+ * what stays resident between fences, not the peak during one.
+ */
+void kvs_space_t::trim (kvs_snapshot_t **snap)
+{
+  if (m_budget == 0 || m_fetch_comm == NULL || !m_uniform
+      || (*snap)->image_size () <= m_budget) {
+    return;
+  }
+  /* keys fetched before take at most half the budget */
+  uint64_t size = m_size;
+  uint64_t rank = m_rank;
+  size_t hot_bytes = 0;
+  auto keep = [&] (const kvs_slot_t *s) -> bool {
+    if (s->hash % size == rank) {
+      return true;
+    }
+    if (m_hot[s->hash % KVS_SPACE_HOT_KEYS].load (std::memory_order_relaxed)
+        != s->hash
+        || hot_bytes + s->key_len + s->val_len > m_budget / 2) {
+      return false;
+    }
+    hot_bytes += s->key_len + s->val_len;
+    return true;
+  };
+  size_t evicted;
+  kvs_snapshot_t *sub = kvs_snapshot_t::subset (*snap, keep, m_rank, &evicted);
+  if (sub == NULL) {
+    return;
+  }
+  delete *snap;
+  *snap = sub;
+  m_trimmed = true;
+  if (m_stats) {
+    m_stats->evictions += evicted;
+  }
+}
+
+int kvs_space_t::serve (uint64_t epoch, const char *key, size_t key_len,
+                        std::string *value)
+{
+  if (m_epoch.load (std::memory_order_acquire) < epoch) {
+    return -1;
+  }
+  if (!rcu_read_lock ()) {
+    return -1;
+  }
+  kvs_snapshot_t *snap = m_global.load (std::memory_order_acquire);
+  kv_str_t v;
+  int found = 0;
+  int rank, col;
+  if (snap == NULL) {
+    found = 0;
+  } else if ( (col = snap->match_col (key, key_len, &rank)) >= 0
+             && snap->col_value (col, rank, &v)) {
+    found = 1;
+  } else {
+    /* including template keys put before the template was registered */
+    const kvs_slot_t *slot = snap->lookup (key, key_len);
+    if (slot != NULL) {
+      v = snap->value (slot);
+      found = 1;
+    }
+  }
+  if (found) {
+    value->assign (v.ptr, v.len);
+  }
+  rcu_read_unlock ();
+  return found;
+}
+
+/* look key up at its home, unless that is here or the trimmed snapshot
+ * tells that no rank put it */
+bool kvs_space_t::refetch (const char *key, size_t key_len,
+                           std::string *value)
+{
+  uint64_t gen;
+  std::string k (key, key_len);
+  {
+    std::lock_guard<std::mutex> guard (m_fetched_lock);
+    std::map<std::string, std::string>::const_iterator f;
+    if ( (f = m_fetched.find (k)) != m_fetched.end ()) {
+      *value = f->second;
+      return true;
+    }
+    if (m_missing.count (k) > 0) {
+      return false;
+    }
+    gen = m_fetched_gen;
+  }
+
+  /* the filter of a trimmed snapshot still has the keys it left out,
+   * and its columns mark the values left with their ranks */
+  uint64_t h = kvs_snapshot_t::hash (key, key_len);
+  int home = h % m_size;
+  int col_home = -1;
+  bool put = false;
+  {
+    bool reading = rcu_read_lock ();
+    std::unique_lock<std::mutex> guard (m_lock, std::defer_lock);
+    if (!reading) {
+      guard.lock ();
+    }
+    kvs_snapshot_t *snap = m_global.load (std::memory_order_acquire);
+    int rank, col;
+    if (snap != NULL) {
+      if ( (col = snap->match_col (key, key_len, &rank)) >= 0
+          && snap->col_evicted (col, rank)) {
+        col_home = rank;
+      }
+      put = snap->may_contain (h);
+    }
+    if (reading) {
+      rcu_read_unlock ();
+    }
+  }
+  if (col_home < 0 && (!put || home == m_rank)) {
+    return false;
+  }
+
+  std::chrono::steady_clock::time_point start;
+  if (m_stats) {
+    start = std::chrono::steady_clock::now ();
+  }
+  /* a template key lives with its rank, unless it was put as a plain key
+   * before the template was registered */
+  int found = 0;
+  if (col_home >= 0) {
+    found = fetch_remote (*m_fetch_comm, col_home, m_index, m_epoch.load (),
+                          key, key_len, value);
+  }
+  if (found == 0 && put && home != m_rank && home != col_home) {
+    found = fetch_remote (*m_fetch_comm, home, m_index, m_epoch.load (),
+                          key, key_len, value);
+  }
+  if (m_stats) {
+    std::chrono::nanoseconds ns = std::chrono::steady_clock::now () - start;
+    m_stats->refetches++;
+    m_stats->refetch_ns += ns.count ();
+  }
+  if (found < 0) {
+    return false;
+  }
+
+  if (found == 1) {
+    m_hot[h % KVS_SPACE_HOT_KEYS].store (h, std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> guard (m_fetched_lock);
+  if (gen == m_fetched_gen) {
+    /* keep what was fetched, and the keys found missing, to a quarter
+     * of the budget */
+    size_t bytes = key_len + (found == 1 ? value->size () : 0);
+    if (m_fetched_bytes + bytes > m_budget / 4) {
+      m_fetched.clear ();
+      m_missing.clear ();
+      m_fetched_bytes = 0;
+    }
+    if (found == 1) {
+      m_fetched[k] = *value;
+    } else {
+      m_missing.insert (k);
+    }
+    m_fetched_bytes += bytes;
+  }
+  return found == 1;
+}
+
+/* find key among local commits (if with_commit) and then in the published
+ * snapshot; the caller keeps whichever it found from changing */
+bool kvs_space_t::lookup (const char *key, size_t key_len, bool with_commit,
+                          kv_str_t *found)
+{
+  int rank, col;
+  kvs_snapshot_t *snap = m_global.load (std::memory_order_acquire);
+
+  found->ptr = NULL;
+  found->len = 0;
+  if (m_stats) {
+    m_stats->gets.fetch_add (1, std::memory_order_relaxed);
+  }
+
+  /* keys of a registered rank template are looked up by index, and as
+   * ordinary keys if they were put before the registration */
+  if (with_commit
+      && (col = m_commit.match_rank_key (key, key_len, &rank)) >= 0
+      && m_commit.m_cols[col].vals[rank].ptr != NULL) {
+    *found = m_commit.m_cols[col].vals[rank];
+  } else if (snap != NULL
+             && (col = snap->match_col (key, key_len, &rank)) >= 0) {
+    snap->col_value (col, rank, found);
+  }
+  if (found->ptr == NULL) {
+    /* local commits since the last fence shadow the published snapshot */
+    if (with_commit && !m_commit.m_map.empty ()) {
+      kv_map_t::const_iterator target = m_commit.find (key);
+      if (target != m_commit.m_map.end ()) {
+        *found = target->second;
+      }
+    }
+    if (found->ptr == NULL && snap != NULL) {
+      /* the bloom filter settles most misses without probing the slots */
+      uint64_t h = kvs_snapshot_t::hash (key, key_len);
+      if (!snap->may_contain (h)) {
+        if (m_stats) {
+          m_stats->bloom_rejects.fetch_add (1, std::memory_order_relaxed);
+        }
+      } else {
+        const kvs_slot_t *slot = snap->lookup (key, key_len, h);
+        if (slot != NULL) {
+          *found = snap->value (slot);
+        }
+      }
+    }
+  }
+
+  if (found->ptr == NULL) {
+    if (m_stats) {
+      m_stats->get_misses.fetch_add (1, std::memory_order_relaxed);
+    }
+    return false;
+  }
+  return true;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
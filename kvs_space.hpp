@@ -0,0 +1,263 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * kvs_space.hpp
+ *
+ * One KVS namespace:
+ *
+ * stages: per-thread append-only logs of str,str (bytes in each log's arena)
+ * commit: avl str-->str committed since the last fence (commit's arena)
+ * global: immutable snapshot published by the last fence
+ *
+ * plus a duplicate of MPI_COMM_WORLD of its own, so that the fences of
+ * different spaces, and the application, never match each other's
+ * messages.
+ *
+ * m_lock serializes everything that changes commit or global (commit,
+ * fence, rank key registration, close) and so every MPI call on the
+ * space's communicator. Puts only lock their own thread's stage. Gets
+ * read global under rcu_read_lock () and take m_lock only while commit
+ * holds entries not yet fenced, since those shadow the snapshot.
+ *
+ * A fence may also be scoped to a group of ranks, whose communicator
+ * (created from the space's, by the group members only) is kept until
+ * the space is closed. It exchanges the members' commits among them only.
+ * A sparse fence instead sends each rank's commits to those that named it
+ * as a source, over a distributed graph built when the sources are set.
+ * Values put for particular ranks wait in an outbox for the next full
+ * fence, which routes them to those ranks alone with an MPI_Alltoallv.
+ *
+ * A snapshot saved by an earlier job step may be restored when the space
+ * is opened, if every rank maps one with the same contents. Fences then
+ * first check, with one MPI_Allreduce, whether every rank committed only
+ * what the snapshot already holds, and skip the exchange if so. The
+ * snapshot stays hidden until the first fence, which publishes it if it
+ * is skipped and drops it otherwise, so the step never sees values it
+ * did not put itself.
+ *
+ * With a memory budget, a full fence whose snapshot outgrows it trims the
+ * snapshot to the entries this rank is home to (see fetch.hpp), its own
+ * template values and keys it had to fetch before. Gets of anything else
+ * fetch it from its home, and keep it until the next fence.
+ *
+ * Spaces, and their stages, are never freed: threads keep pointers to
+ * their stages until they exit. close () releases everything else.
+ */
+
+#ifndef KVS_SPACE_HPP
+#define KVS_SPACE_HPP
+
+#include <mpi.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "fetch.hpp"
+#include "map_wrap.hpp"
+#include "put_log.hpp"
+#include "kvs_snapshot.hpp"
+#include "rcu.hpp"
+#include "pmi.h"
+
+#define KVS_SPACE_NAME_LEN 256
+#define KVS_SPACE_GROUP_TAG 14570
+#define KVS_SPACE_HOT_KEYS 4096
+
+/* counters reported by PMI_Finalize when PMI_MPI_STATS is set; only
+ * touched when it is, so that concurrent Gets share no cache lines */
+struct kvs_stats_t {
+  std::atomic<unsigned long> fences;
+  std::atomic<unsigned long> gets;
+  std::atomic<unsigned long> get_misses;
+  std::atomic<unsigned long> bloom_rejects;
+  std::atomic<unsigned long> wire_bytes;
+  std::atomic<unsigned long> evictions;
+  std::atomic<unsigned long> refetches;
+  std::atomic<unsigned long> refetch_ns;
+};
+
+struct kvs_stage_t {
+  std::mutex lock;
+  std::atomic<bool> owned;
+  put_log_t log;
+};
+
+class kvs_space_t {
+public:
+  explicit kvs_space_t (const char *name);
+
+  /* collective over MPI_COMM_WORLD, as are fence () and close () */
+  bool open ();
+  void close ();
+  /* open a closed space again as a new one, named name; thread stages
+   * keyed by its id stay valid */
+  bool reopen (const char *name);
+  bool is_open () const { return m_open.load (std::memory_order_acquire); }
+  const char *name () const { return m_name; }
+
+  bool put (const char *key, size_t key_len,
+            const char *value, size_t value_len);
+  /* PMI return codes */
+  int put_to (const char *key, size_t key_len,
+              const char *value, size_t value_len,
+              const std::vector<int> &dests);
+  int commit ();
+  int fence (std::mutex *mpi_lock);
+  /* ranks sorted, distinct and including this one; collective over them */
+  int fence_group (const std::vector<int> &ranks, std::mutex *mpi_lock);
+  /* collective over the space; sources need not include this rank */
+  int set_sources (const std::vector<int> &sources, std::mutex *mpi_lock);
+  int fence_sparse (std::mutex *mpi_lock);
+  void register_rank_key (const char *prefix, size_t prefix_len,
+                          const char *suffix, size_t suffix_len);
+  /* collective over the space: restores only if every rank could, and
+   * all got the same contents */
+  bool restore (const char *path, std::mutex *mpi_lock);
+  /* only snapshots every rank has the same of are saved */
+  bool persist (const char *path);
+
+  /* look key up and hand its value to use (kv_str_t) -> int while it is
+   * guaranteed to stay put; returns what use returned, or PMI_FAIL if
+   * there is no such key */
+  template <class F>
+  int get (const char *key, F use);
+
+  /* values served for keys nobody put, such as the job attributes; set
+   * before the space is used and read-only after */
+  void set_attrs (const std::map<std::string, std::string> &attrs)
+  {
+    m_attrs = attrs;
+  }
+
+  /* trim snapshots larger than budget bytes, looking evicted entries up
+   * over fetch_comm, where the space is the index'th of the job; set
+   * before the space is used */
+  void set_budget (size_t budget, MPI_Comm *fetch_comm, uint32_t index)
+  {
+    m_budget = budget;
+    m_fetch_comm = fetch_comm;
+    m_index = index;
+  }
+  /* fetch_serve_t for this space; never blocks */
+  int serve (uint64_t epoch, const char *key, size_t key_len,
+             std::string *value);
+
+  /* only for reporting, once nothing else runs */
+  const kvs_snapshot_t *snapshot () const { return m_global.load (); }
+  size_t fetched_bytes () const { return m_fetched_bytes; }
+
+  /* chunk size, decode threads and nranks are set up by the caller */
+  map_wrap_t m_commit;
+  kvs_stats_t *m_stats;
+
+private:
+  kvs_space_t (const kvs_space_t &);
+  kvs_space_t &operator= (const kvs_space_t &);
+
+  kvs_stage_t *thread_stage ();
+  int exchange (MPI_Comm *comm, std::mutex *mpi_lock, bool targeted);
+  int deliver ();
+  bool redundant (const kvs_snapshot_t *snap);
+  int publish ();
+  bool lookup (const char *key, size_t key_len, bool with_commit,
+               kv_str_t *found);
+  void trim (kvs_snapshot_t **snap);
+  bool refetch (const char *key, size_t key_len, std::string *value);
+
+  char m_name[KVS_SPACE_NAME_LEN];
+  int m_id;
+  MPI_Comm m_comm;
+  int m_rank;
+  int m_size;
+  std::mutex m_lock;
+  std::mutex m_stages_lock;
+  std::vector<kvs_stage_t *> m_stages;
+  std::atomic<bool> m_dirty;
+  std::atomic<kvs_snapshot_t *> m_global;
+  std::atomic<bool> m_open;
+  std::map<std::vector<int>, MPI_Comm> m_groups;
+  MPI_Comm m_sources;
+  /* wire records of the values put for each rank, under m_lock */
+  std::map<int, std::string> m_outbox;
+  std::map<std::string, std::string> m_attrs;
+  /* the snapshot came from a file and every full fence since has been
+   * redundant; collective state, like the fences that change it */
+  bool m_restored;
+  /* the restored snapshot, until the first full fence publishes it */
+  kvs_snapshot_t *m_pending;
+  /* no group, sparse or targeted exchange made snapshots differ */
+  bool m_uniform;
+
+  size_t m_budget;
+  MPI_Comm *m_fetch_comm;
+  uint32_t m_index;
+  /* full fences so far, which is what fetch requests are ordered by */
+  std::atomic<uint64_t> m_epoch;
+  std::atomic<bool> m_trimmed;
+  /* hashes of keys fetched, kept through later trims; lossy */
+  std::atomic<uint64_t> m_hot[KVS_SPACE_HOT_KEYS];
+  /* what was fetched since the snapshot was last published */
+  std::mutex m_fetched_lock;
+  std::map<std::string, std::string> m_fetched;
+  /* keys their homes did not have, until the next fence */
+  std::set<std::string> m_missing;
+  size_t m_fetched_bytes;
+  uint64_t m_fetched_gen;
+};
+
+template <class F>
+int kvs_space_t::get (const char *key, F use)
+{
+  kv_str_t found;
+  bool hit = false;
+  int rc = PMI_FAIL;
+  if (!m_dirty.load () && rcu_read_lock ()) {
+    if ( (hit = lookup (key, strlen (key), false, &found))) {
+      rc = use (found);
+    }
+    rcu_read_unlock ();
+  } else {
+    /* also the fallback when this thread has no RCU reader slot */
+    std::lock_guard<std::mutex> guard (m_lock);
+    if ( (hit = lookup (key, strlen (key), true, &found))) {
+      rc = use (found);
+    }
+  }
+
+  /* then the entry's home, if the snapshot was trimmed; keys no rank
+   * put, the job attributes among them, are settled by its filter
+   * without a round trip */
+  std::string fetched;
+  if (!hit && m_trimmed.load (std::memory_order_relaxed)
+      && (hit = refetch (key, strlen (key), &fetched))) {
+    found.ptr = fetched.c_str ();
+    found.len = fetched.size ();
+    rc = use (found);
+  }
+
+  /* a value put under the key takes precedence */
+  std::map<std::string, std::string>::const_iterator a;
+  if (!hit && !m_attrs.empty () && (a = m_attrs.find (key)) != m_attrs.end ()) {
+    found.ptr = a->second.c_str ();
+    found.len = a->second.size ();
+    rc = use (found);
+  }
+  return rc;
+}
+
+#endif // KVS_SPACE_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
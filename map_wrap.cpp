@@ -8,19 +8,283 @@
  * SPDX-License-Identifier: LGPL-3.0
 \************************************************************/
 
-#include <mpi.h>
 #include <string.h>
+#include <algorithm>
 #include <iostream>
 #include "map_wrap.hpp"
+#include "parallel.hpp"
+
+static inline char *put_u32 (char *p, uint32_t v)
+{
+  memcpy (p, &v, sizeof (v));
+  return p + sizeof (v);
+}
+
+static inline const char *get_u32 (const char *p, const char *last,
+                                   uint32_t *v)
+{
+  if (p == NULL || last - p < (ptrdiff_t) sizeof (*v)) {
+    return NULL;
+  }
+  memcpy (v, p, sizeof (*v));
+  return p + sizeof (*v);
+}
+
+static inline const char *get_bytes (const char *p, const char *last,
+                                     size_t len, const char **out)
+{
+  if (p == NULL || (size_t)(last - p) < len) {
+    return NULL;
+  }
+  *out = p;
+  return p + len;
+}
+
+uint64_t kv_hash (const char *key, size_t len)
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  uint64_t h = len * m;
+
+  while (len >= 8) {
+    uint64_t k;
+    memcpy (&k, key, 8);
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+    key += 8;
+    len -= 8;
+  }
+  if (len) {
+    uint64_t k = 0;
+    memcpy (&k, key, len);
+    h ^= k;
+    h *= m;
+  }
+  return kv_mix64 (h);
+}
+
+bool rank_key_match (const char *prefix, size_t prefix_len,
+                     const char *suffix, size_t suffix_len,
+                     const char *key, size_t key_len, int nranks, int *rank)
+{
+  if (key_len <= prefix_len + suffix_len
+      || memcmp (key, prefix, prefix_len) != 0
+      || memcmp (key + key_len - suffix_len, suffix, suffix_len) != 0) {
+    return false;
+  }
+
+  /* only the canonical spelling of a rank maps to the column, so that
+   * "x-07" stays an ordinary key distinct from "x-7" */
+  const char *p = key + prefix_len;
+  const char *last = key + key_len - suffix_len;
+  if (*p == '0' && last - p > 1) {
+    return false;
+  }
+  long r = 0;
+  for (; p < last; p++) {
+    if (*p < '0' || *p > '9') {
+      return false;
+    }
+    r = r * 10 + (*p - '0');
+    if (r >= nranks) {
+      return false;
+    }
+  }
+  *rank = (int) r;
+  return true;
+}
+
+map_wrap_t::map_wrap_t ()
+  : m_map (kv_str_less_t (), arena_allocator_t<kv_pair_t> (&m_arena)),
+    m_nranks (0), m_chunk_size (MAP_WRAP_CHUNK_SIZE), m_threads (1),
+    m_image_size (0), m_flags (0), m_comm (NULL)
+{
+  m_decoded.valid = false;
+}
+
+const kv_str_t *kv_intern_t::find (const char *p, size_t len,
+                                  uint64_t h) const
+{
+  if (m_count == 0) {
+    return NULL;
+  }
+  size_t mask = m_tab.size () - 1;
+  for (size_t i = h & mask; m_tab[i].str.ptr != NULL; i = (i + 1) & mask) {
+    const ent_t &e = m_tab[i];
+    if (e.hash == h && e.str.len == len && memcmp (e.str.ptr, p, len) == 0) {
+      return &e.str;
+    }
+  }
+  return NULL;
+}
+
+void kv_intern_t::add (kv_str_t v, uint64_t h)
+{
+  /* keep the load at or below 1/2 so probe runs stay short */
+  if (2 * (m_count + 1) > m_tab.size ()) {
+    grow ();
+  }
+  size_t mask = m_tab.size () - 1;
+  size_t i = h & mask;
+  while (m_tab[i].str.ptr != NULL) {
+    i = (i + 1) & mask;
+  }
+  m_tab[i].hash = h;
+  m_tab[i].str = v;
+  m_count++;
+}
+
+void kv_intern_t::grow ()
+{
+  std::vector<ent_t> old (m_tab.size () ? 2 * m_tab.size () : 64, ent_t ());
+  old.swap (m_tab);
+  size_t mask = m_tab.size () - 1;
+  for (size_t j = 0; j < old.size (); j++) {
+    if (old[j].str.ptr != NULL) {
+      size_t i = old[j].hash & mask;
+      while (m_tab[i].str.ptr != NULL) {
+        i = (i + 1) & mask;
+      }
+      m_tab[i] = old[j];
+    }
+  }
+}
+
+void kv_intern_t::clear ()
+{
+  if (m_count) {
+    m_tab.assign (m_tab.size (), ent_t ());
+    m_count = 0;
+  }
+}
+
+void kv_intern_t::release ()
+{
+  std::vector<ent_t> ().swap (m_tab);
+  m_count = 0;
+}
+
+void kv_ref_ids_t::reset (size_t n)
+{
+  size_t size = 16;
+  while (size < 2 * n) {
+    size *= 2;
+  }
+  m_tab.assign (size, std::pair<const char *, uint32_t> (NULL, 0));
+  m_next = 0;
+}
+
+int64_t kv_ref_ids_t::seen (const char *p)
+{
+  size_t mask = m_tab.size () - 1;
+  size_t i = kv_mix64 ((uintptr_t) p) & mask;
+  for (; m_tab[i].first != NULL; i = (i + 1) & mask) {
+    if (m_tab[i].first == p) {
+      return m_tab[i].second;
+    }
+  }
+  m_tab[i].first = p;
+  m_tab[i].second = m_next++;
+  return -1;
+}
+
+/* values that may have to be numbered while packing wrap */
+static size_t ref_candidates (const map_wrap_t &wrap)
+{
+  size_t n = wrap.m_map.size ();
+  for (size_t c = 0; c < wrap.m_cols.size (); c++) {
+    n += wrap.m_cols[c].nset;
+  }
+  return n;
+}
+
+/* bytes a value occupies in the image: none if it goes out as a
+ * reference, which has to agree with map_wrap_packer_t::ref_value () */
+static size_t value_size (kv_str_t value, kv_ref_ids_t &sent)
+{
+  if (value.len >= MAP_WRAP_INTERN_MIN && sent.seen (value.ptr) >= 0) {
+    return 0;
+  }
+  return value.len;
+}
+
+void map_wrap_append_pair (std::string &out, const char *key, size_t key_len,
+                           const char *value, size_t value_len)
+{
+  uint32_t lens[2] = { (uint32_t) key_len, (uint32_t) value_len };
+  out.push_back (MAP_WRAP_REC_PAIR);
+  out.append ((const char *) lens, sizeof (lens));
+  out.append (key, key_len);
+  out.append (value, value_len);
+}
 
 size_t map_wrap_t::packed_size () const
 {
+  return layout (0, NULL, NULL);
+}
+
+/*
+ * Size of the image; with segs, also cut it into segments of at least
+ * seg_size bytes (the last may be shorter), each starting on a record
+ * boundary, and with nrefs, count the values that will be numbered for
+ * references.
+ */
+size_t map_wrap_t::layout (size_t seg_size, std::vector<map_wrap_seg_t> *segs,
+                           uint64_t *nrefs) const
+{
+  kv_ref_ids_t sent;
   size_t size = 0;
-  std::map<std::string, std::string>::const_iterator i;
+  size_t cut = 0;
+  sent.reset (ref_candidates (*this));
+  auto boundary = [&] () {
+    if (segs != NULL && size >= cut) {
+      map_wrap_seg_t seg = { size, sent.count () };
+      segs->push_back (seg);
+      cut = size + seg_size;
+    }
+  };
+
+  kv_map_t::const_iterator i;
   for (i = m_map.begin(); i != m_map.end(); i++) {
-    size_t key_len = (i->first).size() + 1;
-    size_t val_len = (i->second).size() + 1;
-    size += (key_len + val_len);
+    boundary ();
+    size += 1 + 2 * sizeof (uint32_t) + (i->first).len
+            + value_size (i->second, sent);
+  }
+  std::vector<rank_col_t>::const_iterator c;
+  for (c = m_cols.begin (); c != m_cols.end (); c++) {
+    if (c->nset == 0) {
+      continue;
+    }
+    boundary ();
+    size += 1 + 3 * sizeof (uint32_t) + c->prefix.size () + c->suffix.size ();
+    for (size_t r = 0; r < c->vals.size (); r++) {
+      if (c->vals[r].ptr) {
+        size += 2 * sizeof (uint32_t) + value_size (c->vals[r], sent);
+      }
+    }
+  }
+  if (nrefs != NULL) {
+    *nrefs = sent.count ();
+  }
+  return size;
+}
+
+/* size of the image, cut into the segments merge_images () decodes in
+ * parallel */
+size_t map_wrap_t::segments (std::vector<map_wrap_seg_t> &segs,
+                             uint64_t *nrefs) const
+{
+  segs.clear ();
+  size_t size = layout (MAP_WRAP_SEG_MIN, &segs, nrefs);
+  if (segs.size () > MAP_WRAP_MAX_SEGS) {
+    size_t step = (segs.size () + MAP_WRAP_MAX_SEGS - 1) / MAP_WRAP_MAX_SEGS;
+    size_t kept = 0;
+    for (size_t s = 0; s < segs.size (); s += step) {
+      segs[kept++] = segs[s];
+    }
+    segs.resize (kept);
   }
   return size;
 }
@@ -30,101 +294,816 @@ size_t map_wrap_t::pack (char *buf, size_t len) const
   if (buf == NULL || len < packed_size()) {
     return 0;
   }
+  map_wrap_packer_t packer (*this);
+  return packer.fill (buf, len);
+}
 
+size_t map_wrap_t::unpack (const char *buf, size_t len)
+{
+  map_wrap_unpacker_t unpacker (*this);
+  if (!unpacker.feed (buf, len) || !unpacker.complete ()) {
+    /* a truncated or unstorable record is reported through the
+     * returned size, which then falls short of len */
+    return unpacker.consumed ();
+  }
+  return len;
+}
+
+/* stands in for a referred value until the whole image is decoded; len
+ * holds the reference number meanwhile */
+static const char ref_pending[1] = { 0 };
+
+/* a template's values as they appear in one image, which is usually
+ * only a few of the ranks' */
+struct seg_col_t {
+  std::string prefix;
+  std::string suffix;
+  std::vector<uint32_t> ranks;
+  std::vector<kv_str_t> vals;
+};
+
+struct seg_out_t {
+  bool ok;
+  std::vector<kv_str_t> keys;
+  std::vector<kv_str_t> vals;
+  std::vector<seg_col_t> cols;
+};
+
+/* read a value of the given wire length, numbering it if it is interned */
+static const char *get_value (const char *p, const char *last, uint32_t len,
+                              kv_str_t *v, uint64_t *ref, uint64_t ref_end,
+                              std::vector<kv_str_t> &refs)
+{
+  if (len & MAP_WRAP_VAL_REF) {
+    v->ptr = ref_pending;
+    v->len = len & ~MAP_WRAP_VAL_REF;
+    return p;
+  }
+  if ( (p = get_bytes (p, last, len, &v->ptr)) == NULL) {
+    return NULL;
+  }
+  v->len = len;
+  if (len >= MAP_WRAP_INTERN_MIN) {
+    if (*ref >= ref_end) {
+      return NULL;
+    }
+    refs[(*ref)++] = *v;
+  }
+  return p;
+}
+
+/* decode the whole records in [p, last), whose interned values are
+ * numbered ref_base up to ref_end */
+static bool decode_segment (const char *p, const char *last, uint64_t ref_base,
+                            uint64_t ref_end, int nranks,
+                            std::vector<kv_str_t> &refs, seg_out_t &out)
+{
+  uint64_t ref = ref_base;
+  uint32_t a, b, count, rank;
+  const char *k;
+
+  while (p != NULL && p < last) {
+    char type = *p++;
+    kv_str_t key, val;
+    if (type == MAP_WRAP_REC_PAIR) {
+      p = get_u32 (get_u32 (p, last, &a), last, &b);
+      p = get_bytes (p, last, a, &k);
+      if ( (p = get_value (p, last, b, &val, &ref, ref_end, refs)) == NULL) {
+        return false;
+      }
+      key.ptr = k;
+      key.len = a;
+      out.keys.push_back (key);
+      out.vals.push_back (val);
+    } else if (type == MAP_WRAP_REC_RANK) {
+      const char *pre, *suf;
+      p = get_u32 (get_u32 (p, last, &a), last, &b);
+      p = get_bytes (p, last, a, &pre);
+      p = get_bytes (p, last, b, &suf);
+      p = get_u32 (p, last, &count);
+      if (p == NULL) {
+        return false;
+      }
+      out.cols.push_back (seg_col_t ());
+      seg_col_t &col = out.cols.back ();
+      col.prefix.assign (pre, a);
+      col.suffix.assign (suf, b);
+      for (uint32_t e = 0; e < count; e++) {
+        p = get_u32 (get_u32 (p, last, &rank), last, &b);
+        if ( (p = get_value (p, last, b, &val, &ref, ref_end, refs)) == NULL
+            || rank >= (uint32_t) nranks) {
+          return false;
+        }
+        col.ranks.push_back (rank);
+        col.vals.push_back (val);
+      }
+    } else {
+      return false;
+    }
+  }
+  return p == last && ref == ref_end;
+}
+
+static inline bool resolve (kv_str_t *v, const std::vector<kv_str_t> &refs)
+{
+  if (v->ptr == ref_pending) {
+    if (v->len >= refs.size ()) {
+      return false;
+    }
+    *v = refs[v->len];
+  }
+  return true;
+}
+
+/* set the values of col in m_decoded, which gets the template (and so
+ * does the map, as with the streaming unpacker) the first time */
+void map_wrap_t::decoded_col (const seg_col_t &col)
+{
+  size_t c = 0;
+  while (c < m_decoded.cols.size ()
+         && (m_decoded.cols[c].prefix != col.prefix
+             || m_decoded.cols[c].suffix != col.suffix)) {
+    c++;
+  }
+  if (c == m_decoded.cols.size ()) {
+    register_rank_key (col.prefix.data (), col.prefix.size (),
+                       col.suffix.data (), col.suffix.size ());
+    m_decoded.cols.push_back (rank_col_t ());
+    m_decoded.cols[c].prefix = col.prefix;
+    m_decoded.cols[c].suffix = col.suffix;
+    m_decoded.cols[c].vals.resize (m_nranks);
+    m_decoded.cols[c].nset = 0;
+  }
+  rank_col_t &out = m_decoded.cols[c];
+  for (size_t e = 0; e < col.ranks.size (); e++) {
+    if (out.vals[col.ranks[e]].ptr == NULL) {
+      out.nset++;
+    }
+    out.vals[col.ranks[e]] = col.vals[e];
+  }
+}
+
+/*
+ * Decode the images of a fence, laid out in buf, and merge them into
+ * m_decoded: each segment of each image is decoded on its own (on
+ * m_threads threads) into a run in key order, references are resolved
+ * within each image, and the runs are merged with a heap. Where images
+ * hold the same key the later image's value wins, as it does for
+ * template values.
+ */
+bool map_wrap_t::merge_images (const char *buf,
+                               const std::vector<map_wrap_image_t> &images)
+{
+  size_t nimages = images.size ();
+  std::vector<std::vector<kv_str_t> > refs (nimages);
+  /* the runs, by image and then by segment, and the image of each */
+  std::vector<size_t> image_of;
+  for (size_t i = 0; i < nimages; i++) {
+    const map_wrap_image_t &im = images[i];
+    for (size_t s = 0; s < im.segs.size (); s++) {
+      uint64_t end = s + 1 < im.segs.size () ? im.segs[s + 1].off : im.size;
+      uint64_t ref_end = s + 1 < im.segs.size () ? im.segs[s + 1].ref_base
+                         : im.nrefs;
+      if ((s == 0 && (im.segs[0].off != 0 || im.segs[0].ref_base != 0))
+          || im.segs[s].off > end || end > im.size
+          || im.segs[s].ref_base > ref_end || ref_end > im.nrefs) {
+        return false;
+      }
+      image_of.push_back (i);
+    }
+    if (im.segs.empty () && im.size > 0) {
+      return false;
+    }
+    refs[i].resize (im.nrefs);
+  }
+
+  size_t nruns = image_of.size ();
+  std::vector<seg_out_t> out (nruns);
+  std::vector<size_t> seg_of (nruns);
+  for (size_t r = 0; r < nruns; r++) {
+    seg_of[r] = r > 0 && image_of[r - 1] == image_of[r] ? seg_of[r - 1] + 1 : 0;
+  }
+  parallel_each (m_threads, nruns, [&] (size_t r) {
+    const map_wrap_image_t &im = images[image_of[r]];
+    size_t s = seg_of[r];
+    bool last = s + 1 == im.segs.size ();
+    out[r].ok = decode_segment (buf + im.off + im.segs[s].off,
+                                buf + im.off + (last ? im.size
+                                                : im.segs[s + 1].off),
+                                im.segs[s].ref_base,
+                                last ? im.nrefs : im.segs[s + 1].ref_base,
+                                m_nranks, refs[image_of[r]], out[r]);
+  });
+  for (size_t r = 0; r < nruns; r++) {
+    if (!out[r].ok) {
+      return false;
+    }
+  }
+
+  /* references may point to earlier segments of the image, so they can
+   * only be resolved once all of them are decoded */
+  std::atomic<bool> ok (true);
+  kv_str_less_t less;
+  parallel_each (m_threads, nruns, [&] (size_t r) {
+    seg_out_t &o = out[r];
+    const std::vector<kv_str_t> &im_refs = refs[image_of[r]];
+    for (size_t k = 0; k < o.keys.size (); k++) {
+      if (!resolve (&o.vals[k], im_refs)
+          || (k > 0 && !less (o.keys[k - 1], o.keys[k]))) {
+        ok = false;
+      }
+    }
+    for (size_t c = 0; c < o.cols.size (); c++) {
+      for (size_t e = 0; e < o.cols[c].vals.size (); e++) {
+        if (!resolve (&o.cols[c].vals[e], im_refs)) {
+          ok = false;
+        }
+      }
+    }
+  });
+  if (!ok) {
+    return false;
+  }
+  /* the segments of an image follow each other in key order */
+  for (size_t r = 1, prev = 0; r < nruns; r++) {
+    if (image_of[r] != image_of[prev]) {
+      prev = r;
+    } else if (!out[r].keys.empty ()) {
+      if (!out[prev].keys.empty ()
+          && !less (out[prev].keys.back (), out[r].keys.front ())) {
+        return false;
+      }
+      prev = r;
+    }
+  }
+
+  /* the heap's top is the run with the least next key, and of runs with
+   * equal keys (which are of different images) the lowest, so a key's
+   * last value taken is the winner */
+  std::vector<size_t> next (nruns, 0);
+  std::vector<uint32_t> heap;
+  size_t total = 0;
+  for (size_t i = 0; i < nruns; i++) {
+    total += out[i].keys.size ();
+    if (!out[i].keys.empty ()) {
+      heap.push_back (i);
+    }
+  }
+  auto after = [&] (uint32_t a, uint32_t b) {
+    const kv_str_t &ka = out[a].keys[next[a]];
+    const kv_str_t &kb = out[b].keys[next[b]];
+    return less (kb, ka) || (!less (ka, kb) && a > b);
+  };
+  std::make_heap (heap.begin (), heap.end (), after);
+  m_decoded.keys.clear ();
+  m_decoded.vals.clear ();
+  m_decoded.keys.reserve (total);
+  m_decoded.vals.reserve (total);
+  kv_str_equal_t equal;
+  while (!heap.empty ()) {
+    std::pop_heap (heap.begin (), heap.end (), after);
+    uint32_t i = heap.back ();
+    const kv_str_t &key = out[i].keys[next[i]];
+    if (!m_decoded.keys.empty () && equal (m_decoded.keys.back (), key)) {
+      m_decoded.vals.back () = out[i].vals[next[i]];
+    } else {
+      m_decoded.keys.push_back (key);
+      m_decoded.vals.push_back (out[i].vals[next[i]]);
+    }
+    if (++next[i] < out[i].keys.size ()) {
+      std::push_heap (heap.begin (), heap.end (), after);
+    } else {
+      heap.pop_back ();
+    }
+  }
+
+  for (size_t i = 0; i < nruns; i++) {
+    for (size_t c = 0; c < out[i].cols.size (); c++) {
+      decoded_col (out[i].cols[c]);
+    }
+  }
+
+  /* ranks that had not yet learned a template put its keys as ordinary
+   * ones; they belong in the column, as the unpacker would have put them */
+  if (!m_decoded.cols.empty ()) {
+    size_t kept = 0;
+    for (size_t k = 0; k < m_decoded.keys.size (); k++) {
+      const kv_str_t &key = m_decoded.keys[k];
+      int rank;
+      size_t c = 0;
+      while (c < m_decoded.cols.size ()
+             && !rank_key_match (m_decoded.cols[c].prefix.data (),
+                                 m_decoded.cols[c].prefix.size (),
+                                 m_decoded.cols[c].suffix.data (),
+                                 m_decoded.cols[c].suffix.size (),
+                                 key.ptr, key.len, m_nranks, &rank)) {
+        c++;
+      }
+      if (c == m_decoded.cols.size ()) {
+        m_decoded.keys[kept] = key;
+        m_decoded.vals[kept++] = m_decoded.vals[k];
+      } else if (m_decoded.cols[c].vals[rank].ptr == NULL) {
+        m_decoded.cols[c].vals[rank] = m_decoded.vals[k];
+        m_decoded.cols[c].nset++;
+      }
+    }
+    m_decoded.keys.resize (kept);
+    m_decoded.vals.resize (kept);
+  }
+  m_decoded.valid = true;
+  return true;
+}
+
+map_wrap_packer_t::map_wrap_packer_t (const map_wrap_t &wrap)
+  : m_wrap (wrap), m_it (wrap.m_map.begin ()), m_col (0), m_rank (0),
+    m_in_col (false), m_npieces (0), m_cur (0), m_off (0)
+{
+  m_refs.reset (ref_candidates (wrap));
+}
+
+/* false if value was sent before, in which case *val_len refers to it */
+bool map_wrap_packer_t::ref_value (kv_str_t value, uint32_t *val_len)
+{
+  *val_len = value.len;
+  if (value.len < MAP_WRAP_INTERN_MIN) {
+    return true;
+  }
+  int64_t id = m_refs.seen (value.ptr);
+  if (id < 0) {
+    return true;
+  }
+  *val_len = MAP_WRAP_VAL_REF | (uint32_t) id;
+  return false;
+}
+
+/* stage the next record (or rank column entry) as byte ranges */
+bool map_wrap_packer_t::next_record ()
+{
+  uint32_t val_len;
+
+  m_npieces = 0;
+  m_cur = 0;
+  m_off = 0;
+
+  if (m_it != m_wrap.m_map.end ()) {
+    bool send_val = ref_value (m_it->second, &val_len);
+    m_hdr[0] = MAP_WRAP_REC_PAIR;
+    put_u32 (put_u32 (m_hdr + 1, m_it->first.len), val_len);
+    m_piece[0] = m_hdr;
+    m_piece_len[0] = 1 + 2 * sizeof (uint32_t);
+    m_piece[1] = m_it->first.ptr;
+    m_piece_len[1] = m_it->first.len;
+    m_piece[2] = m_it->second.ptr;
+    m_piece_len[2] = m_it->second.len;
+    m_npieces = send_val ? 3 : 2;
+    m_it++;
+    return true;
+  }
+
+  /* rank columns ship the template once and then only rank and value */
+  const std::vector<rank_col_t> &cols = m_wrap.m_cols;
+  while (m_col < cols.size ()) {
+    const rank_col_t &c = cols[m_col];
+    if (!m_in_col) {
+      if (c.nset == 0) {
+        m_col++;
+        continue;
+      }
+      m_hdr[0] = MAP_WRAP_REC_RANK;
+      put_u32 (put_u32 (m_hdr + 1, c.prefix.size ()), c.suffix.size ());
+      put_u32 (m_count, c.nset);
+      m_piece[0] = m_hdr;
+      m_piece_len[0] = 1 + 2 * sizeof (uint32_t);
+      m_piece[1] = c.prefix.data ();
+      m_piece_len[1] = c.prefix.size ();
+      m_piece[2] = c.suffix.data ();
+      m_piece_len[2] = c.suffix.size ();
+      m_piece[3] = m_count;
+      m_piece_len[3] = sizeof (uint32_t);
+      m_npieces = 4;
+      m_in_col = true;
+      m_rank = 0;
+      return true;
+    }
+    for (; m_rank < c.vals.size (); m_rank++) {
+      if (c.vals[m_rank].ptr != NULL) {
+        bool send_val = ref_value (c.vals[m_rank], &val_len);
+        put_u32 (put_u32 (m_hdr, m_rank), val_len);
+        m_piece[0] = m_hdr;
+        m_piece_len[0] = 2 * sizeof (uint32_t);
+        m_piece[1] = c.vals[m_rank].ptr;
+        m_piece_len[1] = c.vals[m_rank].len;
+        m_npieces = send_val ? 2 : 1;
+        m_rank++;
+        return true;
+      }
+    }
+    m_in_col = false;
+    m_col++;
+  }
+  return false;
+}
+
+size_t map_wrap_packer_t::fill (char *buf, size_t len)
+{
   char *p = buf;
-  std::map<std::string, std::string>::const_iterator i;
-  for (i = m_map.begin (); i != m_map.end(); i++) {
-    /* copy in key string */
-    strcpy(p, (i->first).c_str());
-    p += (i->first).size() + 1;
+  char *last = buf + len;
 
-    /* copy in value string */
-    strcpy(p, (i->second).c_str());
-    p += (i->second).size() + 1;
+  while (p < last) {
+    if (m_cur == m_npieces && !next_record ()) {
+      break;
+    }
+    size_t n = m_piece_len[m_cur] - m_off;
+    if (n > (size_t)(last - p)) {
+      n = last - p;
+    }
+    memcpy (p, m_piece[m_cur] + m_off, n);
+    p += n;
+    m_off += n;
+    if (m_off == m_piece_len[m_cur]) {
+      m_cur++;
+      m_off = 0;
+    }
   }
   return static_cast<size_t>(p - buf);
 }
 
-size_t map_wrap_t::unpack (const char *buf, size_t len)
+map_wrap_unpacker_t::map_wrap_unpacker_t (map_wrap_t &wrap)
+  : m_wrap (wrap), m_state (ST_TYPE), m_failed (false), m_need (1),
+    m_have (0), m_total (0), m_consumed (0), m_val (NULL), m_val_len (0),
+    m_left (0), m_rank (0), m_col (-1)
+{
+}
+
+void map_wrap_unpacker_t::expect (state_t state, size_t need)
+{
+  m_state = state;
+  m_need = need;
+  m_have = 0;
+}
+
+/* make room in the arena for the value whose length was just read; a
+ * reference has no bytes to receive */
+bool map_wrap_unpacker_t::alloc_value ()
+{
+  if (m_val_len & MAP_WRAP_VAL_REF) {
+    m_val = NULL;
+    return true;
+  }
+  m_val = (char *) m_wrap.m_arena.alloc (m_val_len + 1, 1);
+  return m_val != NULL;
+}
+
+/* the value just received (or referred to), interned in the map */
+bool map_wrap_unpacker_t::take_value (kv_str_t *value)
+{
+  if (m_val_len & MAP_WRAP_VAL_REF) {
+    uint32_t n = m_val_len & ~MAP_WRAP_VAL_REF;
+    if (n >= m_refs.size ()) {
+      return false;
+    }
+    *value = m_refs[n];
+    return true;
+  }
+  m_val[m_val_len] = '\0';
+  value->ptr = m_val;
+  value->len = m_val_len;
+  if (m_val_len >= MAP_WRAP_INTERN_MIN) {
+    *value = m_wrap.intern_value (*value);
+    m_refs.push_back (*value);
+  }
+  return true;
+}
+
+/* a field has been fully received: store what it completes and say
+ * what comes next */
+bool map_wrap_unpacker_t::field_done ()
+{
+  uint32_t a, b;
+
+  switch (m_state) {
+  case ST_TYPE:
+    if (m_hdr[0] == MAP_WRAP_REC_PAIR) {
+      expect (ST_PAIR_HDR, 2 * sizeof (uint32_t));
+    } else if (m_hdr[0] == MAP_WRAP_REC_RANK) {
+      expect (ST_RANK_HDR, 2 * sizeof (uint32_t));
+    } else {
+      return false;
+    }
+    return true;
+  case ST_PAIR_HDR:
+    memcpy (&a, m_hdr, sizeof (a));
+    memcpy (&m_val_len, m_hdr + sizeof (a), sizeof (m_val_len));
+    m_key.clear ();
+    m_key.reserve (a);
+    expect (ST_PAIR_KEY, a);
+    break;
+  case ST_PAIR_KEY:
+    if (!alloc_value ()) {
+      return false;
+    }
+    expect (ST_PAIR_VAL, m_val ? m_val_len : 0);
+    break;
+  case ST_PAIR_VAL: {
+    kv_str_t v;
+    if (!take_value (&v)
+        || !m_wrap.assign_value (m_key.data (), m_key.size (), v)) {
+      return false;
+    }
+    expect (ST_TYPE, 1);
+    break;
+  }
+  case ST_RANK_HDR:
+    memcpy (&a, m_hdr, sizeof (a));
+    memcpy (&b, m_hdr + sizeof (a), sizeof (b));
+    m_key.clear ();
+    m_suffix.clear ();
+    m_suffix.reserve (b);
+    m_val_len = b;
+    expect (ST_RANK_PREFIX, a);
+    break;
+  case ST_RANK_PREFIX:
+    expect (ST_RANK_SUFFIX, m_val_len);
+    break;
+  case ST_RANK_SUFFIX:
+    m_col = m_wrap.register_rank_key (m_key.data (), m_key.size (),
+                                      m_suffix.data (), m_suffix.size ());
+    expect (ST_RANK_COUNT, sizeof (uint32_t));
+    break;
+  case ST_RANK_COUNT:
+    memcpy (&m_left, m_hdr, sizeof (m_left));
+    expect (m_left ? ST_ENT_HDR : ST_TYPE, m_left ? 2 * sizeof (uint32_t) : 1);
+    break;
+  case ST_ENT_HDR:
+    memcpy (&m_rank, m_hdr, sizeof (m_rank));
+    memcpy (&m_val_len, m_hdr + sizeof (m_rank), sizeof (m_val_len));
+    if (!alloc_value ()) {
+      return false;
+    }
+    expect (ST_ENT_VAL, m_val ? m_val_len : 0);
+    break;
+  case ST_ENT_VAL: {
+    kv_str_t v;
+    if (!take_value (&v) || !m_wrap.assign_rank_value (m_col, m_rank, v)) {
+      return false;
+    }
+    m_left--;
+    expect (m_left ? ST_ENT_HDR : ST_TYPE, m_left ? 2 * sizeof (uint32_t) : 1);
+    break;
+  }
+  }
+  return true;
+}
+
+bool map_wrap_unpacker_t::feed (const char *buf, size_t len)
 {
-  const char *last = buf + len;
   const char *p = buf;
-  size_t size = 0;
+  const char *last = buf + len;
 
-  while (p < last) {
-    std::string key = p;
-    p += key.size () + 1;
-    std::string value = p;
-    p += value.size () + 1; 
-    m_map[key] = value;
-    size++;
+  if (m_failed) {
+    return false;
   }
-  return static_cast<size_t>(p - buf);
+  while (true) {
+    /* zero-length fields complete without consuming input */
+    if (m_have == m_need) {
+      if (!field_done ()) {
+        m_failed = true;
+        return false;
+      }
+      if (m_state == ST_TYPE) {
+        m_consumed = m_total + (p - buf);
+      }
+      continue;
+    }
+    if (p == last) {
+      break;
+    }
+    size_t n = m_need - m_have;
+    if (n > (size_t)(last - p)) {
+      n = last - p;
+    }
+    switch (m_state) {
+    case ST_PAIR_KEY:
+    case ST_RANK_PREFIX:
+      m_key.append (p, n);
+      break;
+    case ST_RANK_SUFFIX:
+      m_suffix.append (p, n);
+      break;
+    case ST_PAIR_VAL:
+    case ST_ENT_VAL:
+      memcpy (m_val + m_have, p, n);
+      break;
+    default:
+      memcpy (m_hdr + m_have, p, n);
+      break;
+    }
+    m_have += n;
+    p += n;
+  }
+  m_total += len;
+  return true;
 }
 
-bool map_wrap_t::insert (std::string key, std::string value)
+bool map_wrap_t::insert (const char *key, size_t key_len,
+                         const char *value, size_t value_len)
 {
-  std::pair<std::map<std::string, std::string>::iterator, bool> ret;
-  ret = m_map.insert (std::pair<std::string, std::string>(key, value));
-  return ret.second;
+  int col, rank;
+  if ( (col = match_rank_key (key, key_len, &rank)) >= 0) {
+    if (m_cols[col].vals[rank].ptr != NULL) {
+      return false;
+    }
+    return assign_rank (col, rank, value, value_len);
+  }
+
+  kv_str_t k = { key, key_len };
+  kv_map_t::iterator i = m_map.lower_bound (k);
+  if (i != m_map.end () && !m_map.key_comp () (k, i->first)) {
+    return false;
+  }
+  kv_str_t kc = { m_arena.dup (key, key_len), key_len };
+  kv_str_t vc = intern (value, value_len);
+  if (kc.ptr == NULL || vc.ptr == NULL) {
+    return false;
+  }
+  m_map.insert (i, kv_pair_t (kc, vc));
+  return true;
 }
 
-int map_wrap_t::send (int receiver) const
+bool map_wrap_t::insert (const std::string &key, const std::string &value)
 {
-  char *send_buf = NULL;
-  int rc = -1;
-  int buf_size = (int) packed_size();
+  return insert (key.data (), key.size (), value.data (), value.size ());
+}
 
-  if ( (rc = MPI_Send((void *)&(buf_size), 1, MPI_INT, receiver,
-                      MAP_WRAP_SEND_SIZE_TAG, MPI_COMM_WORLD)) != 0) {
-    return rc;  
+bool map_wrap_t::assign (const char *key, size_t key_len,
+                         const char *value, size_t value_len)
+{
+  kv_str_t vc = intern (value, value_len);
+  if (vc.ptr == NULL) {
+    return false;
   }
-  if (buf_size == 0) {
-    return 0;
+  return assign_value (key, key_len, vc);
+}
+
+/* like assign (), for a value already interned in the arena */
+bool map_wrap_t::assign_value (const char *key, size_t key_len, kv_str_t vc)
+{
+  int col, rank;
+  if ( (col = match_rank_key (key, key_len, &rank)) >= 0) {
+    return assign_rank_value (col, rank, vc);
+  }
+
+  kv_str_t k = { key, key_len };
+  kv_map_t::iterator i = m_map.lower_bound (k);
+  if (i != m_map.end () && !m_map.key_comp () (k, i->first)) {
+    /* the old value stays in the arena until the next reset */
+    i->second = vc;
+    return true;
+  }
+  kv_str_t kc = { m_arena.dup (key, key_len), key_len };
+  if (kc.ptr == NULL) {
+    return false;
+  }
+  m_map.insert (i, kv_pair_t (kc, vc));
+  return true;
+}
+
+/* copy value into the arena unless an equal one is already there */
+kv_str_t map_wrap_t::intern (const char *value, size_t value_len)
+{
+  kv_str_t v = { value, value_len };
+  uint64_t h = 0;
+  if (value_len >= MAP_WRAP_INTERN_MIN) {
+    h = kv_hash (value, value_len);
+    const kv_str_t *found = m_vals.find (value, value_len, h);
+    if (found != NULL) {
+      return *found;
+    }
   }
-  if ( !(send_buf = (char *) malloc(buf_size))) {
-    return -1;
+  if ( (v.ptr = m_arena.dup (value, value_len)) != NULL
+      && value_len >= MAP_WRAP_INTERN_MIN) {
+    m_vals.add (v, h);
   }
-  if ( (rc = pack(send_buf, buf_size)) == 0 ) {
-    return -1;
+  return v;
+}
+
+/* like intern (), for a value that was just allocated from the arena:
+ * if an equal one is already there, its bytes go back to the arena */
+kv_str_t map_wrap_t::intern_value (kv_str_t value)
+{
+  if (value.len < MAP_WRAP_INTERN_MIN) {
+    return value;
+  }
+  uint64_t h = kv_hash (value.ptr, value.len);
+  const kv_str_t *found = m_vals.find (value.ptr, value.len, h);
+  if (found == NULL) {
+    m_vals.add (value, h);
+    return value;
   }
-  if ( (rc = MPI_Send((void *)send_buf, buf_size, MPI_CHAR, receiver,
-                       MAP_WRAP_SEND_DATA_TAG, MPI_COMM_WORLD) != 0)) {
-    return rc;
+  if (found->ptr != value.ptr) {
+    m_arena.unwind ((void *) value.ptr, value.len + 1);
   }
-  free(send_buf);
-  return 0;
+  return *found;
 }
 
-int map_wrap_t::receive (int sender)
+kv_map_t::const_iterator map_wrap_t::find (const char *key) const
 {
-  int rc = -1;
-  int buf_size;
-  MPI_Status status;
-  char *recv_buf = NULL;
+  kv_str_t k = { key, strlen (key) };
+  return m_map.find (k);
+}
 
-  if ( (rc = MPI_Recv((void *)&buf_size, 1, MPI_INT, sender,
-                      MAP_WRAP_SEND_SIZE_TAG, MPI_COMM_WORLD, &status))) {
-    return rc;
+int map_wrap_t::register_rank_key (const char *prefix, size_t prefix_len,
+                                  const char *suffix, size_t suffix_len)
+{
+  for (size_t c = 0; c < m_cols.size (); c++) {
+    if (m_cols[c].prefix.compare (0, std::string::npos, prefix, prefix_len) == 0
+        && m_cols[c].suffix.compare (0, std::string::npos, suffix,
+                                     suffix_len) == 0) {
+      return c;
+    }
   }
-  if (buf_size == 0) {
-    return 0;
+  rank_col_t col;
+  col.prefix.assign (prefix, prefix_len);
+  col.suffix.assign (suffix, suffix_len);
+  col.vals.resize (m_nranks);
+  col.nset = 0;
+  m_cols.push_back (col);
+  return m_cols.size () - 1;
+}
+
+int map_wrap_t::match_rank_key (const char *key, size_t key_len,
+                                int *rank) const
+{
+  for (size_t c = 0; c < m_cols.size (); c++) {
+    const rank_col_t &col = m_cols[c];
+    if (rank_key_match (col.prefix.data (), col.prefix.size (),
+                        col.suffix.data (), col.suffix.size (),
+                        key, key_len, m_nranks, rank)) {
+      return c;
+    }
   }
-  if ( !(recv_buf = (char *) malloc(buf_size))) {
-    return -1;
+  return -1;
+}
+
+bool map_wrap_t::assign_rank (int col, int rank, const char *value,
+                              size_t value_len)
+{
+  kv_str_t vc = intern (value, value_len);
+  if (vc.ptr == NULL) {
+    return false;
   }
-  if ( (rc = MPI_Recv((void *) recv_buf, buf_size, MPI_CHAR, sender,
-                      MAP_WRAP_SEND_DATA_TAG, MPI_COMM_WORLD, &status)) != 0) {
-    free (recv_buf);
-    return rc;
+  return assign_rank_value (col, rank, vc);
+}
+
+bool map_wrap_t::assign_rank_value (int col, int rank, kv_str_t vc)
+{
+  if (col < 0 || rank < 0 || rank >= m_nranks) {
+    return false;
   }
-  if (unpack (recv_buf, buf_size) < static_cast<size_t>(buf_size))  {
-    free (recv_buf);
-    return -1;
+  rank_col_t &c = m_cols[col];
+  if (c.vals[rank].ptr == NULL) {
+    c.nset++;
   }
+  c.vals[rank] = vc;
+  return true;
+}
 
-  free(recv_buf);
-  return 0;
+void map_wrap_t::clear ()
+{
+  /* the nodes live in the arena, so drop them before resetting it;
+   * registered rank columns stay, only their values go */
+  m_map.clear ();
+  m_vals.clear ();
+  m_decoded.valid = false;
+  m_decoded.keys.clear ();
+  m_decoded.vals.clear ();
+  m_decoded.cols.clear ();
+  drop_values ();
+  m_arena.reset ();
+}
+
+/* before decoding images that already carry this rank's own values */
+void map_wrap_t::drop_values ()
+{
+  m_map.clear ();
+  std::vector<rank_col_t>::iterator c;
+  for (c = m_cols.begin (); c != m_cols.end (); c++) {
+    c->vals.assign (m_nranks, kv_str_t ());
+    c->nset = 0;
+  }
+}
+
+void map_wrap_t::release ()
+{
+  m_map.clear ();
+  m_vals.release ();
+  m_decoded.valid = false;
+  std::vector<kv_str_t> ().swap (m_decoded.keys);
+  std::vector<kv_str_t> ().swap (m_decoded.vals);
+  m_decoded.cols.clear ();
+  m_cols.clear ();
+  m_arena.release ();
+  m_bufs.release ();
 }
 
 /*
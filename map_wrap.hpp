@@ -11,20 +11,312 @@
 #ifndef MAP_WRAP_HPP
 #define MAP_WRAP_HPP
 
+#include <stdint.h>
+#include <string.h>
 #include <map>
 #include <string>
+#include <vector>
+#include "arena.hpp"
+
+/**
+ * Length-delimited view of bytes owned by an arena (always followed by
+ * a NUL so that string values can be handed out as is), or by an image
+ * decoded in place (see map_wrap_decoded_t), where there is no NUL.
+ */
+struct kv_str_t {
+  const char *ptr;
+  size_t len;
+};
+
+struct kv_str_less_t {
+  bool operator() (const kv_str_t &a, const kv_str_t &b) const
+  {
+    int rc = memcmp (a.ptr, b.ptr, a.len < b.len ? a.len : b.len);
+    return rc < 0 || (rc == 0 && a.len < b.len);
+  }
+};
+
+struct kv_str_equal_t {
+  bool operator() (const kv_str_t &a, const kv_str_t &b) const
+  {
+    return a.len == b.len && memcmp (a.ptr, b.ptr, a.len) == 0;
+  }
+};
+
+static inline uint64_t kv_mix64 (uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t kv_hash (const char *p, size_t len);
+
+/**
+ * Set of interned values, open addressed in one flat table. The table is
+ * kept across clear (), so refilling it after a fence does not allocate.
+ */
+class kv_intern_t {
+public:
+  kv_intern_t () : m_count (0) {}
+
+  const kv_str_t *find (const char *p, size_t len, uint64_t h) const;
+  /* v must not be in the set yet */
+  void add (kv_str_t v, uint64_t h);
+  size_t size () const { return m_count; }
+  void clear ();
+  void release ();
+
+private:
+  struct ent_t {
+    uint64_t hash;
+    kv_str_t str;
+  };
+
+  void grow ();
+
+  std::vector<ent_t> m_tab;
+  size_t m_count;
+};
+
+/**
+ * Numbers values by address as the packer first sends them. Values are
+ * interned, so equal values have equal addresses.
+ */
+class kv_ref_ids_t {
+public:
+  kv_ref_ids_t () : m_next (0) {}
+
+  /* make room for up to n values and forget those seen so far */
+  void reset (size_t n);
+  /* the id given to p when it was first seen, or -1 (and p gets the
+   * next id) if this is the first time */
+  int64_t seen (const char *p);
+  uint32_t count () const { return m_next; }
+
+private:
+  std::vector<std::pair<const char *, uint32_t> > m_tab;
+  uint32_t m_next;
+};
+
+typedef std::pair<const kv_str_t, kv_str_t> kv_pair_t;
+typedef std::map<kv_str_t, kv_str_t, kv_str_less_t,
+                 arena_allocator_t<kv_pair_t> > kv_map_t;
+
+/**
+ * Dense per-rank column for the keys registered as "<prefix>%d<suffix>":
+ * the value of "<prefix><r><suffix>" lives at vals[r] (ptr is NULL if
+ * unset) and only the values travel through the exchange.
+ */
+struct rank_col_t {
+  std::string prefix;
+  std::string suffix;
+  std::vector<kv_str_t> vals;
+  size_t nset;
+};
+
+bool rank_key_match (const char *prefix, size_t prefix_len,
+                     const char *suffix, size_t suffix_len,
+                     const char *key, size_t key_len, int nranks, int *rank);
+
+/*
+ * Wire format: a sequence of records, lengths in host byte order
+ *
+ *   'P' u32 key_len u32 val_len key val
+ *   'R' u32 prefix_len u32 suffix_len prefix suffix u32 count
+ *       count * (u32 rank u32 val_len val)
+ *
+ * Values of at least MAP_WRAP_INTERN_MIN bytes are numbered in the order
+ * they appear in the image; a value equal to one already sent is written
+ * as val_len = MAP_WRAP_VAL_REF | number, with no bytes following.
+ */
+#define MAP_WRAP_REC_PAIR 'P'
+#define MAP_WRAP_REC_RANK 'R'
+#define MAP_WRAP_VAL_REF 0x80000000u
+
+/* append a 'P' record, which refers to no other, to out */
+void map_wrap_append_pair (std::string &out, const char *key, size_t key_len,
+                           const char *value, size_t value_len);
+
+/* m_flags: some rank has values put for particular ranks (these are
+ * routed separately from the image) */
+#define MAP_WRAP_FLAG_TARGETED 0x1
+
+/* shorter values are cheaper to repeat than to look up */
+#define MAP_WRAP_INTERN_MIN 8
+
+/* exchanges move the wire image in pieces of at most this many bytes */
+#define MAP_WRAP_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* the images of a fence are cut at record boundaries into segments of
+ * at least MAP_WRAP_SEG_MIN bytes (and at most MAP_WRAP_MAX_SEGS of
+ * them), which are decoded in parallel */
+#define MAP_WRAP_SEG_MIN (1024 * 1024)
+#define MAP_WRAP_MAX_SEGS 256
+
+struct map_wrap_seg_t {
+  uint64_t off;
+  uint64_t ref_base; /* number of the segment's first interned value */
+};
+
+/* where an image lies in the buffer of an exchange, and its segments */
+struct map_wrap_image_t {
+  uint64_t off;
+  uint64_t size;
+  uint64_t nrefs;
+  std::vector<map_wrap_seg_t> segs;
+};
+
+/**
+ * The images of a fence decoded in place and merged: keys and values
+ * point into the receive buffer (m_bufs) and pairs are in key order.
+ * Only valid until the buffer is reused.
+ */
+struct map_wrap_decoded_t {
+  bool valid;
+  std::vector<kv_str_t> keys;
+  std::vector<kv_str_t> vals;
+  std::vector<rank_col_t> cols;
+};
+
+struct seg_col_t;
 
 struct map_wrap_t {
-  const int MAP_WRAP_SEND_SIZE_TAG = 14568;
-  const int MAP_WRAP_SEND_DATA_TAG = 14569;
+  map_wrap_t ();
 
   size_t pack (char *buf, size_t len) const;
   size_t packed_size () const;
+  size_t layout (size_t seg_size, std::vector<map_wrap_seg_t> *segs,
+                 uint64_t *nrefs) const;
+  size_t segments (std::vector<map_wrap_seg_t> &segs, uint64_t *nrefs) const;
   size_t unpack (const char *buf, size_t len);
-  bool insert (std::string key, std::string value);
-  int send (int receiver) const;
-  int receive (int sender);
-  std::map<std::string, std::string> m_map;
+  bool merge_images (const char *buf,
+                     const std::vector<map_wrap_image_t> &images);
+  void decoded_col (const seg_col_t &col);
+  bool insert (const char *key, size_t key_len,
+               const char *value, size_t value_len);
+  bool insert (const std::string &key, const std::string &value);
+  bool assign (const char *key, size_t key_len,
+               const char *value, size_t value_len);
+  bool assign_value (const char *key, size_t key_len, kv_str_t value);
+  kv_str_t intern (const char *value, size_t value_len);
+  kv_str_t intern_value (kv_str_t value);
+  kv_map_t::const_iterator find (const char *key) const;
+  int register_rank_key (const char *prefix, size_t prefix_len,
+                         const char *suffix, size_t suffix_len);
+  int match_rank_key (const char *key, size_t key_len, int *rank) const;
+  bool assign_rank (int col, int rank, const char *value, size_t value_len);
+  bool assign_rank_value (int col, int rank, kv_str_t value);
+  void clear ();
+  /* empty the map and columns, keeping the templates */
+  void drop_values ();
+  void release ();
+  int neighbor_exchange ();
+  int allgather ();
+
+  /* m_arena must be declared (and so constructed) before m_map */
+  arena_t m_arena;
+  mutable buf_pool_t m_bufs;
+  kv_map_t m_map;
+  /* every stored value of at least MAP_WRAP_INTERN_MIN bytes, once: equal
+   * values share their bytes, so the packer can dedup by address */
+  kv_intern_t m_vals;
+  std::vector<rank_col_t> m_cols;
+  int m_nranks;
+  /* leaders broadcast the node images in pieces of this many bytes */
+  size_t m_chunk_size;
+  /* threads decoding the images of a fence */
+  int m_threads;
+  map_wrap_decoded_t m_decoded;
+  /* size of the images last gathered, or received from neighbors */
+  uint64_t m_image_size;
+  /* ORed over all ranks by allgather () */
+  uint64_t m_flags;
+  /* MPI_Comm * to exchange over, NULL for MPI_COMM_WORLD; opaque so that
+   * this header stays free of mpi.h. A distributed graph topology for
+   * neighbor_exchange () */
+  void *m_comm;
+};
+
+/**
+ * Incremental encoder: produces the wire image of a map_wrap_t one chunk
+ * at a time, so that neither side of an exchange needs a buffer holding
+ * the whole image. The map must not change while a packer is active.
+ */
+class map_wrap_packer_t {
+public:
+  map_wrap_packer_t (const map_wrap_t &wrap);
+
+  /* fill buf with up to len bytes of the image; 0 once it is all out */
+  size_t fill (char *buf, size_t len);
+
+private:
+  bool next_record ();
+  bool ref_value (kv_str_t value, uint32_t *val_len);
+
+  const map_wrap_t &m_wrap;
+  kv_ref_ids_t m_refs;
+  kv_map_t::const_iterator m_it;
+  size_t m_col;
+  size_t m_rank;
+  bool m_in_col;
+
+  /* the current record as up to four byte ranges */
+  char m_hdr[16];
+  char m_count[4];
+  const char *m_piece[4];
+  size_t m_piece_len[4];
+  int m_npieces;
+  int m_cur;
+  size_t m_off;
+};
+
+/**
+ * Incremental decoder: feed () accepts the image in arbitrary pieces
+ * (records may straddle them) and stores each record as it completes.
+ * Values are copied once, straight into the map_wrap_t's arena.
+ */
+class map_wrap_unpacker_t {
+public:
+  map_wrap_unpacker_t (map_wrap_t &wrap);
+
+  bool feed (const char *buf, size_t len);
+  /* true if the image ended on a record boundary without errors */
+  bool complete () const { return !m_failed && m_state == ST_TYPE; }
+  /* bytes fed up to the end of the last stored record */
+  size_t consumed () const { return m_consumed; }
+
+private:
+  enum state_t {
+    ST_TYPE, ST_PAIR_HDR, ST_PAIR_KEY, ST_PAIR_VAL,
+    ST_RANK_HDR, ST_RANK_PREFIX, ST_RANK_SUFFIX, ST_RANK_COUNT,
+    ST_ENT_HDR, ST_ENT_VAL
+  };
+
+  void expect (state_t state, size_t need);
+  bool field_done ();
+  bool alloc_value ();
+  bool take_value (kv_str_t *value);
+
+  map_wrap_t &m_wrap;
+  state_t m_state;
+  bool m_failed;
+  size_t m_need;
+  size_t m_have;
+  size_t m_total;
+  size_t m_consumed;
+  char m_hdr[8];
+  std::string m_key;
+  std::string m_suffix;
+  std::vector<kv_str_t> m_refs;
+  char *m_val;
+  uint32_t m_val_len;
+  uint32_t m_left;
+  uint32_t m_rank;
+  int m_col;
 };
 
 #endif // MAP_WRAP_HPP
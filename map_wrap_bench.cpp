@@ -0,0 +1,225 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * map_wrap_bench.cpp
+ *
+ * Standalone microbenchmark for the map_wrap_t serialization path
+ * (insert, packed_size, pack and unpack). It links map_wrap.o and
+ * arena.o only, so it runs without MPI and without a launcher.
+ * Allocation counts include both operator new and malloc calls made by
+ * map_wrap_t. Values are unique unless a percentage of duplicates is
+ * given, which pack then stores once each.
+ *
+ * Usage: map_wrap_bench [iterations [duplicate_percent]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <string>
+#include "map_wrap.hpp"
+
+static size_t alloc_count = 0;
+
+/* the bench is linked with -Wl,--wrap=malloc so that the arena's chunk
+ * allocations are counted alongside operator new */
+extern "C" void *__real_malloc (size_t size);
+
+extern "C" void *__wrap_malloc (size_t size)
+{
+  alloc_count++;
+  return __real_malloc (size);
+}
+
+void *operator new (size_t size)
+{
+  alloc_count++;
+  void *p = __real_malloc (size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc ();
+  }
+  return p;
+}
+
+void operator delete (void *p) noexcept
+{
+  free (p);
+}
+
+void operator delete (void *p, size_t) noexcept
+{
+  free (p);
+}
+
+static double now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* keys look like the ones MPI stacks publish: a fixed prefix padded
+ * to key_len and ending with the (unique) entry index */
+static std::string make_key (size_t i, size_t key_len)
+{
+  char tail[32];
+  int n = snprintf (tail, sizeof (tail), "-%zu", i);
+  std::string key = "key";
+  if (key_len > key.size () + n) {
+    key.append (key_len - key.size () - n, 'k');
+  }
+  key.append (tail);
+  return key;
+}
+
+/* values end with the entry index like the keys, except that dup_pct
+ * entries in every hundred take one of 16 values shared across entries */
+static std::string make_val (size_t i, size_t val_len, int dup_pct)
+{
+  char tail[32];
+  int n = 0;
+  if ((int) (i % 100) >= dup_pct) {
+    n = snprintf (tail, sizeof (tail), "-%zu", i);
+  }
+  std::string val (val_len > (size_t) n ? val_len - n : 0, 'v');
+  for (size_t j = 0; j < val.size (); j++) {
+    val[j] = "0123456789abcdef"[(i + j) & 0xf];
+  }
+  val.append (tail, n);
+  return val;
+}
+
+struct bench_result_t {
+  double insert_sec;
+  double pack_sec;
+  double unpack_sec;
+  size_t bytes;
+  size_t insert_allocs;
+  size_t pack_allocs;
+  size_t unpack_allocs;
+};
+
+static int run_one (size_t nkeys, size_t key_len, size_t val_len,
+                    int dup_pct, int iters, bench_result_t &res)
+{
+  memset (&res, 0, sizeof (res));
+  for (int it = 0; it < iters; it++) {
+    map_wrap_t src;
+    map_wrap_t dst;
+    size_t a0, a1, size;
+    double t0;
+
+    /* keys and values are generated up front so only insert is timed */
+    std::string *keys = new std::string[nkeys];
+    std::string *vals = new std::string[nkeys];
+    for (size_t i = 0; i < nkeys; i++) {
+      keys[i] = make_key (i, key_len);
+      vals[i] = make_val (i, val_len, dup_pct);
+    }
+
+    a0 = alloc_count;
+    t0 = now ();
+    for (size_t i = 0; i < nkeys; i++) {
+      src.insert (keys[i], vals[i]);
+    }
+    res.insert_sec += now () - t0;
+    res.insert_allocs += alloc_count - a0;
+
+    a0 = alloc_count;
+    t0 = now ();
+    size = src.packed_size ();
+    char *buf = (char *) malloc (size);
+    if (buf == NULL || src.pack (buf, size) != size) {
+      fprintf (stderr, "pack failed (nkeys=%zu)\n", nkeys);
+      free (buf);
+      delete[] keys;
+      delete[] vals;
+      return -1;
+    }
+    res.pack_sec += now () - t0;
+    a1 = alloc_count;
+    res.pack_allocs += a1 - a0;
+
+    t0 = now ();
+    if (dst.unpack (buf, size) != size) {
+      fprintf (stderr, "unpack failed (nkeys=%zu)\n", nkeys);
+      free (buf);
+      delete[] keys;
+      delete[] vals;
+      return -1;
+    }
+    res.unpack_sec += now () - t0;
+    res.unpack_allocs += alloc_count - a1;
+    res.bytes = size;
+
+    if (dst.m_map.size () != nkeys) {
+      fprintf (stderr, "unpack lost entries (%zu vs %zu)\n",
+               dst.m_map.size (), nkeys);
+      free (buf);
+      delete[] keys;
+      delete[] vals;
+      return -1;
+    }
+    free (buf);
+    delete[] keys;
+    delete[] vals;
+  }
+  return 0;
+}
+
+int main (int argc, char *argv[])
+{
+  static const size_t key_counts[] = { 1000, 10000, 100000 };
+  static const size_t key_lens[] = { 16, 64 };
+  static const size_t val_lens[] = { 16, 128, 256 };
+  int iters = 5, dup_pct = 0;
+
+  if ((argc > 1 && (iters = atoi (argv[1])) <= 0)
+      || (argc > 2 && ((dup_pct = atoi (argv[2])) < 0 || dup_pct > 100))) {
+    fprintf (stderr, "Usage: %s [iterations [duplicate_percent]]\n",
+             argv[0]);
+    return 1;
+  }
+
+  printf ("%d%% of the values duplicated\n", dup_pct);
+
+  printf ("%8s %6s %6s %10s %9s %9s %11s %11s %9s %9s %9s\n",
+          "entries", "keylen", "vallen", "bytes", "pack_GB/s", "unpk_GB/s",
+          "pack_ent/s", "unpk_ent/s", "ins_alloc", "pack_alloc",
+          "unpk_alloc");
+
+  for (size_t c = 0; c < sizeof (key_counts) / sizeof (key_counts[0]); c++) {
+    for (size_t k = 0; k < sizeof (key_lens) / sizeof (key_lens[0]); k++) {
+      for (size_t v = 0; v < sizeof (val_lens) / sizeof (val_lens[0]); v++) {
+        bench_result_t r;
+        size_t n = key_counts[c];
+        if (run_one (n, key_lens[k], val_lens[v], dup_pct, iters, r) != 0) {
+          return 1;
+        }
+        double pack = r.pack_sec / iters;
+        double unpack = r.unpack_sec / iters;
+        printf ("%8zu %6zu %6zu %10zu %9.3f %9.3f %11.3e %11.3e %9zu %9zu %9zu\n",
+                n, key_lens[k], val_lens[v], r.bytes,
+                r.bytes / pack / 1e9, r.bytes / unpack / 1e9,
+                n / pack, n / unpack,
+                r.insert_allocs / iters, r.pack_allocs / iters,
+                r.unpack_allocs / iters);
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,442 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/* MPI transport for map_wrap_t, kept apart from the (de)serialization code in
+ * map_wrap.cpp so the latter can be linked and benchmarked without MPI */
+
+#include <mpi.h>
+#include <limits.h>
+#include <stdint.h>
+#include "map_wrap.hpp"
+
+/* largest count passed to MPI; smaller values exercise the blocked
+ * gather without gigabytes of data */
+#ifndef MAP_WRAP_MAX_COUNT
+#define MAP_WRAP_MAX_COUNT INT_MAX
+#endif
+
+static inline MPI_Comm comm_of (const map_wrap_t &wrap)
+{
+  return wrap.m_comm ? *(const MPI_Comm *) wrap.m_comm : MPI_COMM_WORLD;
+}
+
+/* the ranks of a fence communicator that share a node, and the lowest
+ * rank of each node; made on first use and freed with the communicator */
+struct node_comms_t {
+  MPI_Comm node;
+  MPI_Comm leaders; /* MPI_COMM_NULL but on the leaders */
+};
+
+static int node_comms_delete (MPI_Comm comm, int keyval, void *attr,
+                              void *extra)
+{
+  node_comms_t *nc = (node_comms_t *) attr;
+  if (nc->leaders != MPI_COMM_NULL) {
+    MPI_Comm_free(&nc->leaders);
+  }
+  MPI_Comm_free(&nc->node);
+  delete nc;
+  return MPI_SUCCESS;
+}
+
+static int node_comms_of (MPI_Comm comm, node_comms_t **out)
+{
+  static int keyval = [] () {
+    int k = MPI_KEYVAL_INVALID;
+    MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, node_comms_delete, &k, NULL);
+    return k;
+  } ();
+  int rc, flag, rank, node_rank;
+  if (keyval == MPI_KEYVAL_INVALID) {
+    return -1;
+  }
+  if ( (rc = MPI_Comm_get_attr(comm, keyval, out, &flag)) != 0 || flag) {
+    return rc;
+  }
+
+  /* keyed by rank, both keep the order of comm */
+  node_comms_t *nc = new node_comms_t;
+  nc->leaders = MPI_COMM_NULL;
+  if ( (rc = MPI_Comm_rank(comm, &rank)) != 0
+      || (rc = MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank,
+                                   MPI_INFO_NULL, &nc->node)) != 0) {
+    delete nc;
+    return rc;
+  }
+  if ( (rc = MPI_Comm_rank(nc->node, &node_rank)) != 0
+      || (rc = MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank,
+                              &nc->leaders)) != 0
+      || (rc = MPI_Comm_set_attr(comm, keyval, nc)) != 0) {
+    node_comms_delete (comm, keyval, nc, NULL);
+    return rc;
+  }
+  *out = nc;
+  return 0;
+}
+
+/*
+ * Lay images of the given sizes out one after the other in blocks of the
+ * smallest size, a power of two, that brings every count and
+ * displacement under MAP_WRAP_MAX_COUNT, each image padded to a whole
+ * number of blocks. Returns the block and sets *total to the bytes of
+ * the layout.
+ */
+static uint64_t block_layout (const std::vector<uint64_t> &sizes,
+                              std::vector<uint64_t> &offs,
+                              std::vector<int> &counts,
+                              std::vector<int> &displs, uint64_t *total)
+{
+  size_t n = sizes.size ();
+  uint64_t block = 1, blocks;
+  for (;;) {
+    blocks = 0;
+    for (size_t i = 0; i < n; i++) {
+      blocks += (sizes[i] + block - 1) / block;
+    }
+    if (blocks <= MAP_WRAP_MAX_COUNT) {
+      break;
+    }
+    block *= 2;
+  }
+  offs.resize (n);
+  counts.resize (n);
+  displs.resize (n);
+  blocks = 0;
+  for (size_t i = 0; i < n; i++) {
+    offs[i] = blocks * block;
+    counts[i] = (int) ((sizes[i] + block - 1) / block);
+    displs[i] = (int) blocks;
+    blocks += counts[i];
+  }
+  *total = blocks * block;
+  return block;
+}
+
+static int block_type (uint64_t block, MPI_Datatype *type)
+{
+  int rc;
+  *type = MPI_CHAR;
+  if (block > 1
+      && ( (rc = MPI_Type_contiguous((int) block, MPI_CHAR, type)) != 0
+          || (rc = MPI_Type_commit(type)) != 0)) {
+    return rc;
+  }
+  return 0;
+}
+
+static void block_type_free (MPI_Datatype *type)
+{
+  if (*type != MPI_CHAR) {
+    MPI_Type_free(type);
+  }
+}
+
+/*
+ * Gather the images of a node's ranks at its leader and unpack them, in
+ * rank order, into merged, which holds each distinct value once however
+ * many of the ranks put it. merged gets the flags of all of them.
+ */
+static int gather_node (const map_wrap_t &wrap, MPI_Comm node,
+                        map_wrap_t &merged)
+{
+  int rc, rank, size;
+  if ( (rc = MPI_Comm_rank(node, &rank)) != 0
+      || (rc = MPI_Comm_size(node, &size)) != 0) {
+    return rc;
+  }
+  uint64_t mine[2] = { wrap.packed_size (), wrap.m_flags };
+  std::vector<uint64_t> all (2 * size);
+  if ( (rc = MPI_Allgather(mine, 2, MPI_UINT64_T, all.data (), 2,
+                           MPI_UINT64_T, node)) != 0) {
+    return rc;
+  }
+  std::vector<uint64_t> sizes (size), offs;
+  std::vector<int> counts, displs;
+  uint64_t total;
+  merged.m_flags = 0;
+  for (int r = 0; r < size; r++) {
+    sizes[r] = all[2 * r];
+    merged.m_flags |= all[2 * r + 1];
+  }
+  uint64_t block = block_layout (sizes, offs, counts, displs, &total);
+
+  /* the leader receives in place, behind its own image */
+  char *buf = NULL;
+  if ( !(buf = merged.m_bufs.get(rank == 0 ? total + 1
+                                 : counts[rank] * block + 1))) {
+    return -1;
+  }
+  if (sizes[rank] > 0 && wrap.pack(buf, sizes[rank]) != sizes[rank]) {
+    return -1;
+  }
+  MPI_Datatype type;
+  if ( (rc = block_type (block, &type)) != 0) {
+    return rc;
+  }
+  if (rank == 0) {
+    rc = MPI_Gatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, buf, counts.data (),
+                     displs.data (), type, 0, node);
+  } else {
+    rc = MPI_Gatherv(buf, counts[rank], type, NULL, NULL, NULL, type, 0, node);
+  }
+  block_type_free (&type);
+  if (rc != 0 || rank != 0) {
+    return rc;
+  }
+  merged.m_nranks = wrap.m_nranks;
+  for (int r = 0; r < size; r++) {
+    if (merged.unpack(buf + offs[r], sizes[r]) != sizes[r]) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Share the image of src, a whole node's, among the leaders: fills in
+ * the size, number of interned values and segments of each leader's
+ * image, laid out in blocks in the buffer of wrap, and ORs their flags.
+ */
+static int allgather_leaders (const map_wrap_t &src, MPI_Comm leaders,
+                              map_wrap_t &wrap,
+                              std::vector<map_wrap_image_t> &images,
+                              uint64_t *flags)
+{
+  int rc, rank, size;
+  if ( (rc = MPI_Comm_rank(leaders, &rank)) != 0
+      || (rc = MPI_Comm_size(leaders, &size)) != 0) {
+    return rc;
+  }
+  std::vector<map_wrap_seg_t> segs;
+  uint64_t mine[4];
+  mine[0] = src.segments (segs, &mine[1]);
+  mine[2] = src.m_flags;
+  mine[3] = segs.size ();
+  std::vector<uint64_t> all (4 * size);
+  if ( (rc = MPI_Allgather(mine, 4, MPI_UINT64_T, all.data (), 4,
+                           MPI_UINT64_T, leaders)) != 0) {
+    return rc;
+  }
+  images.resize (size);
+  std::vector<uint64_t> sizes (size);
+  std::vector<int> seg_counts (size), seg_displs (size);
+  int nsegs = 0;
+  *flags = 0;
+  for (int r = 0; r < size; r++) {
+    images[r].size = sizes[r] = all[4 * r];
+    images[r].nrefs = all[4 * r + 1];
+    *flags |= all[4 * r + 2];
+    seg_counts[r] = 2 * (int) all[4 * r + 3];
+    seg_displs[r] = nsegs;
+    nsegs += seg_counts[r];
+  }
+
+  /* segments as pairs of uint64_t, at most 2 * MAP_WRAP_MAX_SEGS each */
+  std::vector<map_wrap_seg_t> all_segs (nsegs / 2 + 1);
+  if ( (rc = MPI_Allgatherv(segs.data (), (int) (2 * segs.size ()),
+                            MPI_UINT64_T, all_segs.data (), seg_counts.data (),
+                            seg_displs.data (), MPI_UINT64_T, leaders)) != 0) {
+    return rc;
+  }
+  for (int r = 0; r < size; r++) {
+    images[r].segs.assign (all_segs.begin () + seg_displs[r] / 2,
+                           all_segs.begin () + (seg_displs[r]
+                                                + seg_counts[r]) / 2);
+  }
+
+  std::vector<uint64_t> offs;
+  std::vector<int> counts, displs;
+  uint64_t total;
+  uint64_t block = block_layout (sizes, offs, counts, displs, &total);
+
+  /* the buffer belongs to m_bufs and is reused by the next exchange */
+  char *buf = NULL;
+  if ( !(buf = wrap.m_bufs.get(total + 1))) {
+    return -1;
+  }
+  if (sizes[rank] > 0 && src.pack(buf + offs[rank], sizes[rank]) != sizes[rank]) {
+    return -1;
+  }
+  MPI_Datatype type;
+  if ( (rc = block_type (block, &type)) != 0) {
+    return rc;
+  }
+  rc = MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, buf, counts.data (),
+                      displs.data (), type, leaders);
+  block_type_free (&type);
+  return rc;
+}
+
+/*
+ * Share every rank's image with all the others and merge them into
+ * m_decoded, with no rank building the union of all in its map first.
+ * The leader of each node gathers and merges the images of the node's
+ * ranks, so that a value many of them put crosses the network once per
+ * node; one MPI_Allgatherv among the leaders lays the node images out in
+ * every leader's buffer; each leader broadcasts that to its node in
+ * pieces of m_chunk_size bytes, and merge_images () decodes them in
+ * place. The map and columns are emptied, since the images include this
+ * rank's own. Where ranks put the same key the value of the highest node
+ * (by its lowest rank) wins, and within a node the highest rank's.
+ */
+int map_wrap_t::allgather ()
+{
+  int rc = -1;
+  int node_rank, node_size;
+  node_comms_t *nc = NULL;
+  if ( (rc = node_comms_of (comm_of (*this), &nc)) != 0
+      || (rc = MPI_Comm_rank(nc->node, &node_rank)) != 0
+      || (rc = MPI_Comm_size(nc->node, &node_size)) != 0) {
+    return rc;
+  }
+
+  map_wrap_t merged;
+  const map_wrap_t *src = this;
+  if (node_size > 1) {
+    if ( (rc = gather_node (*this, nc->node, merged)) != 0) {
+      return rc;
+    }
+    src = &merged;
+  }
+
+  /* the flags of all ranks, the number of node images, then the size,
+   * number of interned values and segments of each */
+  std::vector<map_wrap_image_t> images;
+  std::vector<uint64_t> hdr (1);
+  if (nc->leaders != MPI_COMM_NULL) {
+    uint64_t flags;
+    if ( (rc = allgather_leaders (*src, nc->leaders, *this, images,
+                                  &flags)) != 0) {
+      return rc;
+    }
+    hdr.push_back (flags);
+    hdr.push_back (images.size ());
+    for (size_t i = 0; i < images.size (); i++) {
+      hdr.push_back (images[i].size);
+      hdr.push_back (images[i].nrefs);
+      hdr.push_back (images[i].segs.size ());
+      for (size_t s = 0; s < images[i].segs.size (); s++) {
+        hdr.push_back (images[i].segs[s].off);
+        hdr.push_back (images[i].segs[s].ref_base);
+      }
+    }
+    hdr[0] = hdr.size ();
+  }
+  if (node_size > 1) {
+    if ( (rc = MPI_Bcast(hdr.data (), 1, MPI_UINT64_T, 0, nc->node)) != 0) {
+      return rc;
+    }
+    hdr.resize (hdr[0]);
+    if ( (rc = MPI_Bcast(hdr.data (), (int) hdr.size (), MPI_UINT64_T, 0,
+                         nc->node)) != 0) {
+      return rc;
+    }
+  }
+  if (nc->leaders == MPI_COMM_NULL) {
+    size_t h = 3;
+    images.resize (hdr[2]);
+    for (size_t i = 0; i < images.size (); i++) {
+      images[i].size = hdr[h++];
+      images[i].nrefs = hdr[h++];
+      images[i].segs.resize (hdr[h++]);
+      for (size_t s = 0; s < images[i].segs.size (); s++) {
+        images[i].segs[s].off = hdr[h++];
+        images[i].segs[s].ref_base = hdr[h++];
+      }
+    }
+  }
+  m_flags = hdr[1];
+
+  std::vector<uint64_t> sizes (images.size ()), offs;
+  std::vector<int> counts, displs;
+  uint64_t total;
+  for (size_t i = 0; i < images.size (); i++) {
+    sizes[i] = images[i].size;
+  }
+  block_layout (sizes, offs, counts, displs, &total);
+  m_image_size = 0;
+  for (size_t i = 0; i < images.size (); i++) {
+    images[i].off = offs[i];
+    m_image_size += sizes[i];
+  }
+  char *buf = NULL;
+  if ( !(buf = m_bufs.get(total + 1))) {
+    return -1;
+  }
+  for (uint64_t off = 0; node_size > 1 && off < total; off += m_chunk_size) {
+    uint64_t len = total - off < m_chunk_size ? total - off : m_chunk_size;
+    if ( (rc = MPI_Bcast(buf + off, (int) len, MPI_CHAR, 0, nc->node)) != 0) {
+      return rc;
+    }
+  }
+  drop_values ();
+  return merge_images (buf, images) ? 0 : -1;
+}
+
+/*
+ * Send this rank's image to its out-neighbors in the distributed graph
+ * m_comm and merge the images of its in-neighbors. Each image must fit
+ * in an int count, as must all those received together.
+ */
+int map_wrap_t::neighbor_exchange ()
+{
+  int rc = -1;
+  int indeg, outdeg, weighted;
+  uint64_t size = packed_size();
+  char *buf = NULL;
+
+  if ( (rc = MPI_Dist_graph_neighbors_count(comm_of (*this), &indeg, &outdeg,
+                                            &weighted)) != 0) {
+    return rc;
+  }
+  if (size > INT_MAX) {
+    return -1;
+  }
+  std::vector<uint64_t> sizes (indeg > 0 ? indeg : 1);
+  if ( (rc = MPI_Neighbor_allgather(&size, 1, MPI_UINT64_T, sizes.data (), 1,
+                                    MPI_UINT64_T, comm_of (*this))) != 0) {
+    return rc;
+  }
+  std::vector<int> counts (indeg > 0 ? indeg : 1), displs (counts.size ());
+  uint64_t total = 0;
+  for (int i = 0; i < indeg; i++) {
+    counts[i] = (int) sizes[i];
+    displs[i] = (int) total;
+    if ( (total += sizes[i]) > INT_MAX) {
+      return -1;
+    }
+  }
+  m_image_size = total;
+
+  /* own image first, the received ones behind it */
+  if ( !(buf = m_bufs.get(size + total + 1))) {
+    return -1;
+  }
+  if (outdeg == 0) {
+    size = 0;
+  } else if (size > 0 && pack(buf, size) != size) {
+    return -1;
+  }
+  if ( (rc = MPI_Neighbor_allgatherv(buf, (int) size, MPI_CHAR, buf + size,
+                                     counts.data (), displs.data (), MPI_CHAR,
+                                     comm_of (*this))) != 0) {
+    return rc;
+  }
+  for (int i = 0; i < indeg; i++) {
+    if (unpack(buf + size + displs[i], counts[i]) != (size_t) counts[i]) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
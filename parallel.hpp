@@ -0,0 +1,95 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * parallel.hpp
+ *
+ * Fork/join helpers for the decode and indexing phases of a fence. The
+ * workers never call MPI; they only touch memory handed to them.
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/* upper bound on PMI_MPI_DECODE_THREADS */
+#define PARALLEL_MAX_THREADS 64
+
+/**
+ * Run fn (t) for t = 0 .. nthreads - 1, t = 0 on the calling thread, and
+ * wait for all of them. If threads cannot be started the remaining calls
+ * run on the caller.
+ */
+template <class F>
+void parallel_run (int nthreads, F fn)
+{
+  std::vector<std::thread> threads;
+  int t = 1;
+  try {
+    for (; t < nthreads; t++) {
+      threads.push_back (std::thread (fn, t));
+    }
+  } catch (const std::system_error &) {
+  }
+  fn (0);
+  for (int late = t; late < nthreads; late++) {
+    fn (late);
+  }
+  for (size_t i = 0; i < threads.size (); i++) {
+    threads[i].join ();
+  }
+}
+
+/**
+ * Call fn (i) for every i in [0, n) from nthreads threads, handing out
+ * items one at a time so that uneven items balance out.
+ */
+template <class F>
+void parallel_each (int nthreads, size_t n, F fn)
+{
+  std::atomic<size_t> next (0);
+  if (nthreads > (int) n) {
+    nthreads = (int) n;
+  }
+  parallel_run (nthreads < 1 ? 1 : nthreads, [&] (int) {
+    for (size_t i; (i = next++) < n; ) {
+      fn (i);
+    }
+  });
+}
+
+/**
+ * Call fn (begin, end) on nthreads contiguous slices of [0, n).
+ */
+template <class F>
+void parallel_range (int nthreads, size_t n, F fn)
+{
+  if (nthreads > (int) n) {
+    nthreads = (int) n;
+  }
+  if (nthreads <= 1) {
+    fn ((size_t) 0, n);
+    return;
+  }
+  parallel_run (nthreads, [&] (int t) {
+    fn (n * t / nthreads, n * (t + 1) / nthreads);
+  });
+}
+
+#endif // PARALLEL_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -12,15 +12,26 @@
 
 #include <mpi.h>
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "pmi.h"
-#include "map_wrap.hpp"
-#include "reduce.hpp"
+#include "pmi_ext.h"
+#include "kvs_space.hpp"
+#include "codec.hpp"
+#include "fetch.hpp"
+#include "parallel.hpp"
+#include "progress.hpp"
+#include "topo.hpp"
 
 using namespace std;
 
@@ -29,10 +40,14 @@ static int ranks = -1;
 static int my_rank = -1;
 static int id = -1;
 static bool debug = false;
+static bool stats = false;
 
 #define MAX_KVS_LEN (256)
 #define MAX_KEY_LEN (256)
 #define MAX_VAL_LEN (256)
+#define MAX_VAL_LEN_LIMIT (64 * 1024 * 1024)
+#define MIN_CHUNK_SIZE (4 * 1024)
+#define MAX_CHUNK_SIZE (1024 * 1024 * 1024)
 
 #ifndef DPRINTF
  #define DPRINTF(fmt,...) do { \
@@ -41,17 +56,308 @@ static bool debug = false;
 #endif
 
 static char kvs_name[MAX_KVS_LEN];
+static int max_val_len = MAX_VAL_LEN;
+
+static size_t chunk_size = MAP_WRAP_CHUNK_SIZE;
+static int decode_threads = 1;
+static kvs_stats_t counters;
 
 /*
-put:    avl str-->str
-commit: avl str-->str
-global: avl str-->str
-mem:    avl void*-->null
+Every KVS space (see kvs_space.hpp) has its own store, communicator and
+lock, so spaces fence independently of each other. The space named by
+PMI_KVS_Get_my_name is opened by PMI_Init, others by PMI_KVS_Create.
+Slots are only ever appended to (under spaces_lock), so looking a space
+up by name takes no lock. A destroyed space keeps its slot and object,
+which the next PMI_KVS_Create opens again under the new name.
 */
+#define MAX_KVS_SPACES 64
+static std::atomic<kvs_space_t *> spaces[MAX_KVS_SPACES];
+static std::atomic<int> nspaces (0);
+static std::mutex spaces_lock;
+static int spaces_created = 0;
+
+/* without MPI_THREAD_MULTIPLE, fences of different spaces take turns */
+static std::mutex mpi_lock;
+static bool mpi_multiple = false;
+
+/* with PMI_MPI_PROGRESS set, fences run on this thread instead */
+static progress_t progress;
+static std::mutex fence_lock;
+static bool fence_pending = false;
+static uint64_t fence_ticket;
+static int fence_rc;
+
+/* which ranks share this node, found when MPI starts */
+static node_topo_t topo;
+
+/* with PMI_MPI_SNAPSHOT_DIR set, snapshots are kept there between steps */
+static const char *snapshot_dir = NULL;
+
+/* with PMI_MPI_MEM_BUDGET set, snapshots over it are trimmed and what
+ * they lose is fetched from its home rank through fetch_server */
+static size_t mem_budget = 0;
+static MPI_Comm fetch_comm = MPI_COMM_NULL;
+static fetch_server_t fetch_server;
+
+static int start_mpi( void );
+
+/* spaces are only opened once MPI is up, so looking one up is what
+ * brings it up when PMI_Init left that for later */
+static kvs_space_t *find_space( const char *kvsname )
+{
+  if (start_mpi() != PMI_SUCCESS) {
+    return NULL;
+  }
+  int n = nspaces.load (std::memory_order_acquire);
+  for (int i = 0; i < n; i++) {
+    kvs_space_t *space = spaces[i].load (std::memory_order_acquire);
+    if (space->is_open() && strcmp(space->name(), kvsname) == 0) {
+      return space;
+    }
+  }
+  return NULL;
+}
+
+/* open a space and list it; collective, like the MPI_Comm_dup under it.
+ * Spaces are created and destroyed in the same order everywhere, so the
+ * first closed slot, which is reused, is the same everywhere too */
+static kvs_space_t *add_space( const char *name )
+{
+  std::lock_guard<std::mutex> guard (spaces_lock);
+  int n = nspaces.load ();
+  int i;
+  for (i = 0; i < n && spaces[i].load ()->is_open (); i++) {
+  }
+  if (i < n) {
+    kvs_space_t *space = spaces[i].load ();
+    std::unique_lock<std::mutex> mpi_guard (mpi_lock, std::defer_lock);
+    if (!mpi_multiple) {
+      mpi_guard.lock ();
+    }
+    return space->reopen (name) ? space : NULL;
+  }
+  if (n == MAX_KVS_SPACES) {
+    return NULL;
+  }
+
+  kvs_space_t *space = new kvs_space_t (name);
+  space->m_commit.m_nranks = ranks;
+  space->m_commit.m_chunk_size = chunk_size;
+  space->m_commit.m_threads = decode_threads;
+  space->m_stats = stats ? &counters : NULL;
+  if (fetch_comm != MPI_COMM_NULL) {
+    space->set_budget (mem_budget, &fetch_comm, n);
+  }
+  std::unique_lock<std::mutex> mpi_guard (mpi_lock, std::defer_lock);
+  if (!mpi_multiple) {
+    mpi_guard.lock ();
+  }
+  if (!space->open ()) {
+    delete space;
+    return NULL;
+  }
+  spaces[n].store (space, std::memory_order_release);
+  nspaces.store (n + 1, std::memory_order_release);
+  return space;
+}
+
+/* spaces are opened in the same order everywhere, so a space's index
+ * names it to other processes; one not opened here yet soon will be */
+static int serve_fetch( uint32_t index, uint64_t epoch, const char *key, size_t len, string *value )
+{
+  if (index >= (uint32_t) nspaces.load (std::memory_order_acquire)) {
+    return -1;
+  }
+  return spaces[index].load (std::memory_order_acquire)->serve (epoch, key, len, value);
+}
+
+/* job attributes served from the job's space without a fence; see
+ * pmi_ext.h */
+static map<string, string> job_attrs( void )
+{
+  map<string, string> attrs;
+  string mapping = topo.process_mapping ();
+  if (mapping.size() <= (size_t) max_val_len) {
+    attrs["PMI_process_mapping"] = mapping;
+  }
 
-typedef map<string,string> str2str;
-static str2str put;
-static map_wrap_t commit;
+  const vector<int> &clique = topo.clique ();
+  int local_rank = lower_bound(clique.begin(), clique.end(), my_rank)
+                   - clique.begin();
+  attrs["PMI_MPI_node_id"] = to_string(topo.node_of ()[my_rank]);
+  attrs["PMI_MPI_num_nodes"] = to_string(topo.nnodes ());
+  attrs["PMI_MPI_local_rank"] = to_string(local_rank);
+  attrs["PMI_MPI_local_size"] = to_string(clique.size());
+  return attrs;
+}
+
+/* file holding the snapshot of a space, for this job and geometry only;
+ * empty if snapshots are not kept */
+static string snapshot_path( const char *name )
+{
+  if (snapshot_dir == NULL) {
+    return "";
+  }
+  const char *job = getenv ("LSB_JOBID");
+  if (job == NULL) {
+    job = getenv ("SLURM_JOB_ID");
+  }
+  string mapping = topo.process_mapping ();
+  char file[128];
+  snprintf(file, sizeof (file), "/pmi-snap-%d-%016llx-", ranks,
+           (unsigned long long) kv_hash (mapping.data(), mapping.size()));
+  return string(snapshot_dir) + file + (job ? job : "0") + "-" + name;
+}
+
+/* collective, like opening the space */
+static void restore_space( kvs_space_t *space )
+{
+  string path = snapshot_path(space->name ());
+  if (!path.empty()
+      && space->restore (path.c_str(), mpi_multiple ? NULL : &mpi_lock)) {
+    DPRINTF ("%d: KVS %s restored from %s\n", my_rank, space->name (),
+             path.c_str());
+  }
+}
+
+static int fence_space( kvs_space_t *space )
+{
+  if (space->fence (mpi_multiple ? NULL : &mpi_lock) != PMI_SUCCESS) {
+    DPRINTF ("%d: fence of KVS %s failed.\n", my_rank, space->name ());
+    return PMI_FAIL;
+  }
+  return PMI_SUCCESS;
+}
+
+static int fence_space_group( kvs_space_t *space, const vector<int> &group )
+{
+  if (space->fence_group (group, mpi_multiple ? NULL : &mpi_lock)
+      != PMI_SUCCESS) {
+    DPRINTF ("%d: group fence of KVS %s failed.\n", my_rank, space->name ());
+    return PMI_FAIL;
+  }
+  return PMI_SUCCESS;
+}
+
+static int fence_space_sparse( kvs_space_t *space )
+{
+  if (space->fence_sparse (mpi_multiple ? NULL : &mpi_lock) != PMI_SUCCESS) {
+    DPRINTF ("%d: sparse fence of KVS %s failed.\n", my_rank, space->name ());
+    return PMI_FAIL;
+  }
+  return PMI_SUCCESS;
+}
+
+/* fence every space, in the order they were created */
+static int fence( void )
+{
+  int n = nspaces.load ();
+  for (int i = 0; i < n; i++) {
+    kvs_space_t *space = spaces[i].load ();
+    if (space->is_open () && fence_space (space) != PMI_SUCCESS) {
+      return PMI_FAIL;
+    }
+  }
+  return PMI_SUCCESS;
+}
+
+/* rank and size as set by launchers we know, if all of them are valid */
+static bool env_rank_size( int *rank, int *size )
+{
+  static const char *vars[][2] = {
+    { "JSM_NAMESPACE_RANK", "JSM_NAMESPACE_SIZE" },
+    { "OMPI_COMM_WORLD_RANK", "OMPI_COMM_WORLD_SIZE" },
+    { "SLURM_PROCID", "SLURM_NTASKS" },
+  };
+  for (size_t i = 0; i < sizeof (vars) / sizeof (vars[0]); i++) {
+    const char *r = getenv (vars[i][0]);
+    const char *s = getenv (vars[i][1]);
+    if (r == NULL || s == NULL) {
+      continue;
+    }
+    char *end_r, *end_s;
+    long lr = strtol (r, &end_r, 10);
+    long ls = strtol (s, &end_s, 10);
+    if (*r == '\0' || *end_r != '\0' || *s == '\0' || *end_s != '\0'
+        || ls < 1 || ls > INT_MAX || lr < 0 || lr >= ls) {
+      continue;
+    }
+    *rank = (int) lr;
+    *size = (int) ls;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Initialize MPI and what depends on it: the node topology, the progress
+ * thread and the job's space. Runs once, from PMI_Init or from the first
+ * call that needs it; every process must get there, since MPI_Init and
+ * opening the space are collective.
+ */
+static std::mutex mpi_start_lock;
+static std::atomic<bool> mpi_started (false);
+
+static int start_mpi( void )
+{
+  if (mpi_started.load (std::memory_order_acquire)) {
+    return PMI_SUCCESS;
+  }
+  std::lock_guard<std::mutex> guard (mpi_start_lock);
+  if (mpi_started.load ()) {
+    return PMI_SUCCESS;
+  }
+
+  /* spaces fence concurrently if MPI allows; otherwise their MPI calls
+   * are serialized by mpi_lock, though not always made by one thread */
+  int provided, mpi_rank, mpi_size;
+  if (MPI_Init_thread (NULL, NULL, MPI_THREAD_MULTIPLE, &provided) != 0)
+    return PMI_FAIL;
+  mpi_multiple = (provided >= MPI_THREAD_MULTIPLE);
+  if (provided < MPI_THREAD_SERIALIZED) {
+    DPRINTF ("%d: PMI_Init (MPI provides thread level %d only)\n", my_rank,
+             provided);
+  }
+  if (MPI_Comm_size (MPI_COMM_WORLD, &mpi_size) != 0)
+    return PMI_FAIL;
+  if (MPI_Comm_rank (MPI_COMM_WORLD, &mpi_rank) != 0)
+    return PMI_FAIL;
+  if (initialized && (mpi_rank != my_rank || mpi_size != ranks)) {
+    DPRINTF ("%d: PMI_Init (MPI has rank %d of %d, launcher said %d of %d)\n",
+             mpi_rank, mpi_rank, mpi_size, my_rank, ranks);
+  }
+  my_rank = mpi_rank;
+  ranks = mpi_size;
+  if (!topo.init ())
+    return PMI_FAIL;
+
+  /* the fetch server answers while other threads are in MPI */
+  if (mem_budget > 0 && !mpi_multiple) {
+    DPRINTF ("%d: PMI_Init (no MPI_THREAD_MULTIPLE, memory budget ignored)\n",
+             my_rank);
+  } else if (mem_budget > 0) {
+    if (MPI_Comm_dup (MPI_COMM_WORLD, &fetch_comm) != MPI_SUCCESS)
+      return PMI_FAIL;
+    if (!fetch_server.start (fetch_comm, serve_fetch)) {
+      MPI_Comm_free (&fetch_comm);
+      return PMI_FAIL;
+    }
+  }
+
+  if (getenv ("PMI_MPI_PROGRESS") != NULL && !progress.start ()) {
+    DPRINTF ("%d: PMI_Init (no progress thread, fencing inline)\n", my_rank);
+  }
+
+  kvs_space_t *space;
+  if ( (space = add_space(kvs_name)) == NULL) {
+    DPRINTF ("%d: PMI_Init (OOM)\n", my_rank);
+    return PMI_ERR_NOMEM;
+  }
+  space->set_attrs (job_attrs ());
+  restore_space(space);
+  mpi_started.store (true, std::memory_order_release);
+  return PMI_SUCCESS;
+}
 
 extern "C" int PMI_Init( int *spawned )
 {
@@ -59,6 +365,49 @@ extern "C" int PMI_Init( int *spawned )
   if (getenv ("PMI_MPI_DEBUG") != NULL) {
     debug = true;
   }
+  if (getenv ("PMI_MPI_STATS") != NULL) {
+    stats = true;
+  }
+
+  /* values larger than MAX_VAL_LEN are opt-in, since PMI clients size
+   * their Get buffers from PMI_KVS_Get_value_length_max */
+  const char *env;
+  if ( (env = getenv ("PMI_MPI_MAX_VAL_LEN")) != NULL) {
+    long len = strtol (env, NULL, 0);
+    if (len >= MAX_VAL_LEN && len <= MAX_VAL_LEN_LIMIT) {
+      max_val_len = (int) len;
+    }
+  }
+  if ( (env = getenv ("PMI_MPI_CHUNK_SIZE")) != NULL) {
+    long len = strtol (env, NULL, 0);
+    if (len >= MIN_CHUNK_SIZE && len <= MAX_CHUNK_SIZE) {
+      chunk_size = (size_t) len;
+    }
+  }
+  snapshot_dir = getenv ("PMI_MPI_SNAPSHOT_DIR");
+  /* bytes, or with a K, M or G suffix */
+  if ( (env = getenv ("PMI_MPI_MEM_BUDGET")) != NULL) {
+    char *end;
+    unsigned long long budget = strtoull (env, &end, 0);
+    switch (*end) {
+    case 'G': case 'g':
+      budget <<= 10;
+      /* fall through */
+    case 'M': case 'm':
+      budget <<= 10;
+      /* fall through */
+    case 'K': case 'k':
+      budget <<= 10;
+    }
+    mem_budget = (size_t) budget;
+  }
+  /* threads for decoding and indexing large fence images */
+  if ( (env = getenv ("PMI_MPI_DECODE_THREADS")) != NULL) {
+    long n = strtol (env, NULL, 0);
+    if (n >= 1 && n <= PARALLEL_MAX_THREADS) {
+      decode_threads = (int) n;
+    }
+  }
 
   /* check that we got a variable to write our flag value to */
   if (spawned == NULL) {
@@ -68,25 +417,25 @@ extern "C" int PMI_Init( int *spawned )
   /* we don't support spawned procs */
   *spawned = PMI_FALSE;
 
-  if (MPI_Init (NULL, NULL) != 0)
-    goto error;
-  if (MPI_Comm_size (MPI_COMM_WORLD, &ranks) != 0)
-    goto error;
-  if (MPI_Comm_rank (MPI_COMM_WORLD, &my_rank) != 0)
-    goto error;
-
+  /* a launcher that tells each process its rank and the job size lets
+   * us answer those without MPI, until something has to communicate */
   id = 0; /* TODO: This may not work */
-  if (snprintf(kvs_name, MAX_KVS_LEN, "%d", id) < MAX_KVS_LEN) {
+  if (snprintf(kvs_name, MAX_KVS_LEN, "%d", id) >= MAX_KVS_LEN) {
+    return PMI_FAIL;
+  }
+  if (env_rank_size(&my_rank, &ranks)) {
     initialized = 1;
-    DPRINTF ("%d: PMI_Init succeeded\n", my_rank);  
+    DPRINTF ("%d: PMI_Init succeeded (MPI deferred)\n", my_rank);
     return PMI_SUCCESS;
-  } else {
-    DPRINTF ("%d: PMI_Init (OOM)\n", my_rank);  
-    return PMI_ERR_NOMEM;
   }
 
-error:
-  return PMI_FAIL;
+  int rc;
+  if ( (rc = start_mpi()) != PMI_SUCCESS) {
+    return rc;
+  }
+  initialized = 1;
+  DPRINTF ("%d: PMI_Init succeeded\n", my_rank);
+  return PMI_SUCCESS;
 }
 
 extern "C" int PMI_Initialized( PMI_BOOL *out_initialized )
@@ -110,14 +459,81 @@ extern "C" int PMI_Finalize( void )
 {
   int rc = PMI_SUCCESS;
 
+  /* nothing communicated, so there is no MPI to finalize */
+  if (!mpi_started.load ()) {
+    DPRINTF ("%d: PMI_Finalize succeeded (MPI never started).\n", my_rank);
+    return rc;
+  }
+
+  /* a fence still in flight completes, unwaited for, before MPI goes */
+  progress.stop ();
+
+  /* once every process is here, none will fetch anything more */
+  if (fetch_server.running ()) {
+    MPI_Barrier (fetch_comm);
+    fetch_server.stop ();
+    MPI_Comm_free (&fetch_comm);
+  }
+
+  int n = nspaces.load ();
+  if (stats) {
+    size_t keys = 0, image_bytes = 0, bloom_bytes = 0, resident_bytes = 0;
+    double bloom_fpr = 0.0;
+    for (int i = 0; i < n; i++) {
+      const kvs_snapshot_t *snap = spaces[i].load ()->snapshot ();
+      if (snap != NULL) {
+        keys += snap->count ();
+        image_bytes += snap->image_size ();
+        bloom_bytes += snap->bloom_bytes ();
+        if (snap->bloom_fpr () > bloom_fpr) {
+          bloom_fpr = snap->bloom_fpr ();
+        }
+      }
+      resident_bytes += spaces[i].load ()->fetched_bytes ();
+    }
+    resident_bytes += image_bytes;
+    unsigned long refetches = counters.refetches.load ();
+    fprintf (stdout, "%d: PMI stats: fences=%lu gets=%lu misses=%lu "
+             "bloom_rejects=%lu wire_bytes=%lu keys=%zu image_bytes=%zu "
+             "bloom_bytes=%zu bloom_fpr=%.4f resident_bytes=%zu "
+             "evictions=%lu refetches=%lu refetch_us=%.1f\n", my_rank,
+             counters.fences.load (), counters.gets.load (),
+             counters.get_misses.load (), counters.bloom_rejects.load (),
+             counters.wire_bytes.load (), keys, image_bytes, bloom_bytes,
+             bloom_fpr, resident_bytes, counters.evictions.load (),
+             refetches, refetches ? counters.refetch_ns.load ()
+                                    / (1e3 * refetches) : 0.0);
+  }
+  /* one process per node leaves the snapshots for the next step, and
+   * removes what an earlier step left for a space it does not save, so
+   * that no node restores contents the others no longer have */
+  if (snapshot_dir != NULL && topo.clique ()[0] == my_rank) {
+    std::set<string> saved;
+    for (int i = 0; i < n; i++) {
+      kvs_space_t *space = spaces[i].load ();
+      string path = snapshot_path(space->name ());
+      if (space->is_open () && space->persist (path.c_str())) {
+        saved.insert (path);
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      string path = snapshot_path(spaces[i].load ()->name ());
+      if (saved.count (path) == 0) {
+        DPRINTF ("%d: KVS %s not saved to %s\n", my_rank,
+                 spaces[i].load ()->name (), path.c_str());
+        unlink (path.c_str());
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    spaces[i].load ()->close ();
+  }
+
   if (MPI_Finalize() != 0) {
     DPRINTF ("%d: PMI_Finalize failed.\n", my_rank);
     rc = PMI_FAIL;
   }
 
-  put.clear ();
-  commit.m_map.clear ();
-
   DPRINTF ("%d: PMI_Finalize succeeded.\n", my_rank);
   return rc;
 }
@@ -198,8 +614,73 @@ extern "C" int PMI_Get_appnum( int *appnum )
   return PMI_SUCCESS;
 }
 
+extern "C" int PMI_Get_clique_size( int *size )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_Get_clique_size (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* the first call that communicates brings MPI up */
+  if (start_mpi() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Get_clique_size (MPI failed to start).\n", my_rank);
+    return PMI_FAIL;
+  }
+
+  /* check that we got a variable to write our value to */
+  if (size == NULL) {
+    DPRINTF ("%d: PMI_Get_clique_size (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  *size = (int) topo.clique ().size ();
+  DPRINTF ("%d: PMI_Get_clique_size succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_Get_clique_ranks( int clique_ranks[], int length )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_Get_clique_ranks (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* the first call that communicates brings MPI up */
+  if (start_mpi() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Get_clique_ranks (MPI failed to start).\n", my_rank);
+    return PMI_FAIL;
+  }
+
+  /* check that we got an array large enough for the clique */
+  if (clique_ranks == NULL) {
+    DPRINTF ("%d: PMI_Get_clique_ranks (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  const vector<int> &clique = topo.clique ();
+  if (length < (int) clique.size ()) {
+    DPRINTF ("%d: PMI_Get_clique_ranks (invalid length).\n", my_rank);
+    return PMI_ERR_INVALID_LENGTH;
+  }
+
+  for (size_t i = 0; i < clique.size (); i++) {
+    clique_ranks[i] = clique[i];
+  }
+  DPRINTF ("%d: PMI_Get_clique_ranks succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
 extern "C" int PMI_Abort(int exit_code, const char error_msg[])
 {
+  if (error_msg != NULL) {
+    fprintf (stderr, "%d: PMI_Abort: %s\n", my_rank, error_msg);
+  }
+  /* PMI_Finalize is collective once MPI is up, and the other ranks are
+   * not coming */
+  if (mpi_started.load ()) {
+    MPI_Abort (MPI_COMM_WORLD, exit_code);
+  }
   PMI_Finalize ();
   exit(exit_code);
 
@@ -286,17 +767,79 @@ extern "C" int PMI_KVS_Get_value_length_max( int *length )
     return PMI_ERR_INVALID_ARG;
   }
 
-  *length = MAX_VAL_LEN;
+  *length = max_val_len;
   DPRINTF ("%d: PMI_KVS_Get_value_length_max succeeded.\n", my_rank);
   return PMI_SUCCESS;
 }
 
 extern "C" int PMI_KVS_Create( char kvsname[], int length )
 {
-  /* since we don't support spawning, we just have a static key value space */
-  int rc = PMI_KVS_Get_my_name(kvsname, length);
-  DPRINTF ("%d: PMI_KVS_Create (rc=%d).\n", my_rank, rc);
-  return rc;
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Create (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* the first call that communicates brings MPI up */
+  if (start_mpi() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_KVS_Create (MPI failed to start).\n", my_rank);
+    return PMI_FAIL;
+  }
+
+  /* check that we got a buffer large enough for any name */
+  if (kvsname == NULL) {
+    DPRINTF ("%d: PMI_KVS_Create (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  if (length < MAX_KVS_LEN) {
+    DPRINTF ("%d: PMI_KVS_Create (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_LENGTH;
+  }
+
+  /* every process creates the space, so every process names it the same
+   * way: after the job's space and how many were created before it */
+  char name[MAX_KVS_LEN];
+  int len;
+  {
+    std::lock_guard<std::mutex> guard (spaces_lock);
+    len = snprintf(name, sizeof (name), "%s.%d", kvs_name, ++spaces_created);
+  }
+  kvs_space_t *space;
+  if (len >= (int) sizeof (name) || (space = add_space(name)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Create (failed).\n", my_rank);
+    return PMI_FAIL;
+  }
+  restore_space(space);
+
+  strcpy(kvsname, name);
+  DPRINTF ("%d: PMI_KVS_Create succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Destroy( const char kvsname[] )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Destroy (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* the job's own space stays */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || strcmp(kvsname, kvs_name) == 0
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Destroy (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  std::unique_lock<std::mutex> mpi_guard (mpi_lock, std::defer_lock);
+  if (!mpi_multiple) {
+    mpi_guard.lock ();
+  }
+  space->close();
+  DPRINTF ("%d: PMI_KVS_Destroy succeeded.\n", my_rank);
+  return PMI_SUCCESS;
 }
 
 extern "C" int PMI_KVS_Put( const char kvsname[], const char key[], const char value[])
@@ -320,25 +863,86 @@ extern "C" int PMI_KVS_Put( const char kvsname[], const char key[], const char v
   }
 
   /* check length of value */
-  if (value == NULL || strlen(value) > MAX_VAL_LEN) {
+  if (value == NULL || strlen(value) > (size_t)max_val_len) {
     DPRINTF ("%d: PMI_KVS_Put (invalid argument).\n", my_rank);
     return PMI_ERR_INVALID_VAL;
   }
 
   /* check that kvsname is the correct one */
-  if (strcmp(kvsname, kvs_name) != 0) {
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
     DPRINTF ("%d: PMI_KVS_Put (invalid argument).\n", my_rank);
     return PMI_ERR_INVALID_KVS;
   }
       
-  /* add string to put */
-  pair<string,string> kv(key, value);
-  put.insert(kv);
+  /* append to this thread's stage; a later put of the same key wins at
+   * commit */
+  if (!space->put(key, strlen(key), value, strlen(value))) {
+    DPRINTF ("%d: PMI_KVS_Put (OOM).\n", my_rank);
+    return PMI_ERR_NOMEM;
+  }
 
   DPRINTF ("%d: PMI_KVS_Put succeeded.\n", my_rank);
   return PMI_SUCCESS;
 }
 
+extern "C" int PMI_KVS_Put_to( const char kvsname[], const char key[], const char value[], const int dest_ranks[], int count )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Put_to (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check length of name */
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check length of key */
+  if (key == NULL || strlen(key) > MAX_KEY_LEN) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KEY;
+  }
+
+  /* check length of value */
+  if (value == NULL || strlen(value) > (size_t)max_val_len) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_VAL;
+  }
+
+  /* check that the destinations are ranks of the job */
+  if (count < 1 || dest_ranks == NULL) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  vector<int> dests (dest_ranks, dest_ranks + count);
+  sort(dests.begin(), dests.end());
+  dests.erase(unique(dests.begin(), dests.end()), dests.end());
+  if (dests.front() < 0 || dests.back() >= ranks) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  /* check that kvsname is the correct one */
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Put_to (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  int rc;
+  if ( (rc = space->put_to(key, strlen(key), value, strlen(value), dests))
+       != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_KVS_Put_to (OOM).\n", my_rank);
+    return rc;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Put_to succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
 extern "C" int PMI_KVS_Commit( const char kvsname[] )
 {
   /* check that we're initialized */
@@ -354,42 +958,42 @@ extern "C" int PMI_KVS_Commit( const char kvsname[] )
   }
 
   /* check that kvsname is the correct one */
-  if (strcmp(kvsname, kvs_name) != 0) {
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
     DPRINTF ("%d: PMI_KVS_Commit (invalid argument).\n", my_rank);
     return PMI_ERR_INVALID_KVS;
   }
       
-  /* copy all entries in put to commit, in order to overwrite existing
-   * entires in commit, we may have to erase before the insert */
-  str2str::iterator i;
-  str2str::iterator target;
-  for (i = put.begin(); i != put.end(); i++) {
-    /* search for this string in commit */
-    string key = i->first;
-    target = commit.m_map.find(key);
-
-    /* if we found an existing entry in commit, we need to erase it */
-    if (target != commit.m_map.end()) {
-      commit.m_map.erase(target);
-    }
-
-    /* now insert value from put */
-    commit.m_map.insert(*i);
+  /* merge the staged puts of every thread into the space's commits */
+  if (space->commit() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_KVS_Commit (OOM).\n", my_rank);
+    return PMI_ERR_NOMEM;
   }
 
-  /* clear put */
-  put.clear();
-
   DPRINTF ("%d: PMI_KVS_Commit succeeded.\n", my_rank);
   return PMI_SUCCESS;
 }
 
-extern "C" int PMI_Barrier( void )
+/* start a fence, on the progress thread if there is one; fence_lock
+ * guards the one fence that may be started and not yet waited for */
+static void fence_start( void )
+{
+  if (progress.running()) {
+    fence_ticket = progress.post(fence);
+  } else {
+    fence_rc = fence();
+  }
+  fence_pending = true;
+}
+
+static int fence_wait( void )
 {
-  int rc = -1;
-  int total_size = 0;
-  char *buf = NULL;
+  fence_pending = false;
+  return progress.running() ? progress.wait(fence_ticket) : fence_rc;
+}
 
+extern "C" int PMI_Barrier( void )
+{
   /* check that we're initialized */
   if (!initialized) {
     /* would like to return PMI_ERR_INIT here, but definition says
@@ -399,41 +1003,256 @@ extern "C" int PMI_Barrier( void )
     return PMI_FAIL;
   }
 
-  BinomialReducer<map_wrap_t> reducer;
-  if ( (rc = reducer.reduce (0, my_rank, ranks, commit)) != 0) {
-    DPRINTF ("%d: PMI_Barrier (reducer failed).\n", my_rank);
+  /* the first call that communicates brings MPI up */
+  if (start_mpi() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Barrier (MPI failed to start).\n", my_rank);
+    return PMI_FAIL;
+  }
+
+  /* a fence started earlier completes first */
+  std::lock_guard<std::mutex> guard (fence_lock);
+  if (fence_pending && fence_wait() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Barrier (started fence failed).\n", my_rank);
+    return PMI_FAIL;
+  }
+  fence_start();
+  if (fence_wait() != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+
+  DPRINTF ("%d: PMI_Barrier succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_Barrier_start( void )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_Barrier_start (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* the first call that communicates brings MPI up */
+  if (start_mpi() != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Barrier_start (MPI failed to start).\n", my_rank);
     return PMI_FAIL;
   }
 
-  if (my_rank == 0) {
-    total_size = commit.packed_size ();
+  std::lock_guard<std::mutex> guard (fence_lock);
+  if (fence_pending) {
+    DPRINTF ("%d: PMI_Barrier_start (fence already started).\n", my_rank);
+    return PMI_FAIL;
+  }
+  fence_start();
+
+  DPRINTF ("%d: PMI_Barrier_start succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_Barrier_wait( void )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_Barrier_wait (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
   }
-  if ( (rc = MPI_Bcast(&total_size, 1, MPI_INT, 0, MPI_COMM_WORLD)) != 0) {
-    DPRINTF ("%d: PMI_Barrier (Bcast failed for total_size).\n", my_rank);
+
+  std::lock_guard<std::mutex> guard (fence_lock);
+  if (!fence_pending) {
+    DPRINTF ("%d: PMI_Barrier_wait (no fence started).\n", my_rank);
     return PMI_FAIL;
   }
-  if ( (buf = (char *)malloc (total_size)) == NULL) {
-    DPRINTF ("%d: PMI_Barrier (OOM).\n", my_rank);
+  if (fence_wait() != PMI_SUCCESS) {
     return PMI_FAIL;
   }
-  if (my_rank == 0) {
-    if ( (rc = commit.pack (buf, total_size)) == 0) {
-      DPRINTF ("%d: PMI_Barrier (pack failed).\n", my_rank);
-      return PMI_FAIL;
-    }
-  } 
-  if ( (rc = MPI_Bcast(buf, total_size, MPI_CHAR, 0, MPI_COMM_WORLD)) != 0) {
+
+  DPRINTF ("%d: PMI_Barrier_wait succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Fence( const char kvsname[] )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Fence (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check that kvsname is a space we know */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Fence (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  int rc;
+  if (progress.running()) {
+    rc = progress.wait(progress.post([space] () { return fence_space(space); }));
+  } else {
+    rc = fence_space(space);
+  }
+  if (rc != PMI_SUCCESS) {
     return PMI_FAIL;
   }
-  if (my_rank != 0) {
-    size_t size;
-    if ( (size = commit.unpack (buf, total_size)) < static_cast<size_t>(total_size)) {
-      DPRINTF ("%d: PMI_Barrier (unpack failed: ret size (%d) vs. size (%d)).\n", my_rank, (int)size, (int)total_size);
-      return PMI_FAIL;
-    } 
+
+  DPRINTF ("%d: PMI_KVS_Fence succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Fence_group( const char kvsname[], const int group_ranks[], int count )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Fence_group (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
   }
 
-  DPRINTF ("%d: PMI_Barrier succeeded.\n", my_rank);
+  /* check that kvsname is a space we know */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Fence_group (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check that the group holds distinct ranks of the job, this one among
+   * them; members may list it in any order */
+  if (group_ranks == NULL || count < 1 || count > ranks) {
+    DPRINTF ("%d: PMI_KVS_Fence_group (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  vector<int> group (group_ranks, group_ranks + count);
+  sort(group.begin(), group.end());
+  if (group.front() < 0 || group.back() >= ranks
+      || adjacent_find(group.begin(), group.end()) != group.end()
+      || !binary_search(group.begin(), group.end(), my_rank)) {
+    DPRINTF ("%d: PMI_KVS_Fence_group (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  int rc;
+  if (progress.running()) {
+    rc = progress.wait(progress.post([space, &group] () {
+      return fence_space_group(space, group);
+    }));
+  } else {
+    rc = fence_space_group(space, group);
+  }
+  if (rc != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Fence_group succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Set_sources( const char kvsname[], const int source_ranks[], int count )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Set_sources (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check that kvsname is a space we know */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Set_sources (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check that the sources are ranks of the job; each is read once */
+  if (count < 0 || (count > 0 && source_ranks == NULL)) {
+    DPRINTF ("%d: PMI_KVS_Set_sources (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  vector<int> sources (source_ranks, source_ranks + count);
+  sort(sources.begin(), sources.end());
+  sources.erase(unique(sources.begin(), sources.end()), sources.end());
+  if (!sources.empty() && (sources.front() < 0 || sources.back() >= ranks)) {
+    DPRINTF ("%d: PMI_KVS_Set_sources (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  int rc;
+  std::mutex *lock = mpi_multiple ? NULL : &mpi_lock;
+  if (progress.running()) {
+    rc = progress.wait(progress.post([space, &sources, lock] () {
+      return space->set_sources(sources, lock);
+    }));
+  } else {
+    rc = space->set_sources(sources, lock);
+  }
+  if (rc != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_KVS_Set_sources (failed).\n", my_rank);
+    return PMI_FAIL;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Set_sources succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Fence_sparse( const char kvsname[] )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Fence_sparse (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check that kvsname is a space we know */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Fence_sparse (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  int rc;
+  if (progress.running()) {
+    rc = progress.wait(progress.post([space] () {
+      return fence_space_sparse(space);
+    }));
+  } else {
+    rc = fence_space_sparse(space);
+  }
+  if (rc != PMI_SUCCESS) {
+    return PMI_FAIL;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Fence_sparse succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Register_rank_key( const char kvsname[], const char key_template[] )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Register_rank_key (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check that kvsname is the correct one */
+  kvs_space_t *space;
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN
+      || (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Register_rank_key (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check that the template has exactly one %d */
+  const char *d;
+  if (key_template == NULL || strlen(key_template) > MAX_KEY_LEN
+      || (d = strstr(key_template, "%d")) == NULL
+      || strstr(d + 2, "%d") != NULL) {
+    DPRINTF ("%d: PMI_KVS_Register_rank_key (invalid template).\n", my_rank);
+    return PMI_ERR_INVALID_KEY;
+  }
+
+  space->register_rank_key(key_template, d - key_template, d + 2, strlen(d + 2));
+  DPRINTF ("%d: PMI_KVS_Register_rank_key succeeded.\n", my_rank);
   return PMI_SUCCESS;
 }
 
@@ -452,7 +1271,8 @@ extern "C" int PMI_KVS_Get( const char kvsname[], const char key[], char value[]
   }
 
   /* check that kvsname is the correct one */
-  if (strcmp(kvsname, kvs_name) != 0) {
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
     DPRINTF ("%d: PMI_KVS_Get (invalid argument).\n", my_rank);
     return PMI_ERR_INVALID_KVS;
   }
@@ -469,26 +1289,260 @@ extern "C" int PMI_KVS_Get( const char kvsname[], const char key[], char value[]
     return PMI_ERR_INVALID_VAL;
   }
 
-  /* lookup entry from commit */
-  string keystr = key;
-  str2str::iterator target = commit.m_map.find(keystr);
-  if (target == commit.m_map.end()) {
+  int rc = space->get(key, [&] (kv_str_t found) {
+    /* check that the user's buffer is large enough */
+    int len = found.len + 1;
+    if (length < len) {
+      DPRINTF ("%d: PMI_KVS_Get (invalid argument).\n", my_rank);
+      return PMI_ERR_INVALID_LENGTH;
+    }
+
+    /* copy the value into user's buffer */
+    memcpy(value, found.ptr, len);
+    return PMI_SUCCESS;
+  });
+  if (rc == PMI_FAIL) {
     /* failed to find the key */
     DPRINTF ("%d: PMI_KVS_Get (ENOENT).\n", my_rank);
-    return PMI_FAIL;
+  }
+  if (rc != PMI_SUCCESS) {
+    return rc;
   }
 
-  /* check that the user's buffer is large enough */
-  int len = (target->second).size() + 1;
-  if (length < len) {
-    DPRINTF ("%d: PMI_KVS_Get (invalid argument).\n", my_rank);
+  DPRINTF ("%d: PMI_KVS_Get succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Put_bytes( const char kvsname[], const char key[], const void *value, int length )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check length of name */
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check length of key */
+  if (key == NULL || strlen(key) > MAX_KEY_LEN) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KEY;
+  }
+
+  /* check the value buffer and its length */
+  if ((value == NULL && length > 0) || length < 0 || length > max_val_len) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_VAL_LENGTH;
+  }
+
+  /* check that kvsname is the correct one */
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* values are length delimited end to end, so the bytes go in as is */
+  if (!space->put(key, strlen(key), (const char *)value, length)) {
+    DPRINTF ("%d: PMI_KVS_Put_bytes (OOM).\n", my_rank);
+    return PMI_ERR_NOMEM;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Put_bytes succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_KVS_Get_bytes( const char kvsname[], const char key[], void *value, int length, int *out_length )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check length of name */
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check that kvsname is the correct one */
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check length of key */
+  if (key == NULL || strlen(key) > MAX_KEY_LEN) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KEY;
+  }
+
+  /* check that we have somewhere to write to */
+  if ((value == NULL && length > 0) || out_length == NULL) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_VAL;
+  }
+
+  int rc = space->get(key, [&] (kv_str_t found) {
+    /* report the size even when the buffer is too small for it */
+    *out_length = found.len;
+    if (length < (int)found.len) {
+      DPRINTF ("%d: PMI_KVS_Get_bytes (invalid length).\n", my_rank);
+      return PMI_ERR_INVALID_LENGTH;
+    }
+    memcpy(value, found.ptr, found.len);
+    return PMI_SUCCESS;
+  });
+  if (rc == PMI_FAIL) {
+    DPRINTF ("%d: PMI_KVS_Get_bytes (ENOENT).\n", my_rank);
+  }
+  if (rc != PMI_SUCCESS) {
+    return rc;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Get_bytes succeeded.\n", my_rank);
+  return PMI_SUCCESS;
+}
+
+/* decode len bytes of src into value; shared by PMI_Decode and
+ * PMI_KVS_Get_decoded */
+static int decode_value( int encoding, const char *src, size_t len, void *value, int length, int *out_length )
+{
+  size_t need;
+  if (encoding == PMI_ENCODING_HEX) {
+    if (len % 2 != 0) {
+      return PMI_ERR_INVALID_VAL;
+    }
+    need = len / 2;
+  } else if (encoding == PMI_ENCODING_BASE64) {
+    if ( (need = codec_base64_decoded_len(src, len)) == (size_t) -1) {
+      return PMI_ERR_INVALID_VAL;
+    }
+  } else {
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  /* report the size even when the buffer is too small for it */
+  *out_length = (int) need;
+  if (length < 0 || (size_t) length < need) {
     return PMI_ERR_INVALID_LENGTH;
   }
 
-  /* copy the value into user's buffer */
-  strcpy(value, (target->second).c_str());
+  bool ok = (encoding == PMI_ENCODING_HEX)
+            ? codec_hex_decode(src, len, (uint8_t *) value)
+            : codec_base64_decode(src, len, (uint8_t *) value);
+  return ok ? PMI_SUCCESS : PMI_ERR_INVALID_VAL;
+}
+
+extern "C" int PMI_Encode( int encoding, const void *src, int src_length, char dst[], int length, int *out_length )
+{
+  /* the codec does not depend on PMI_Init, so neither does this */
+  if ((src == NULL && src_length > 0) || src_length < 0 || dst == NULL
+      || out_length == NULL) {
+    DPRINTF ("%d: PMI_Encode (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
 
-  DPRINTF ("%d: PMI_KVS_Get succeeded.\n", my_rank);
+  size_t need;
+  if (encoding == PMI_ENCODING_HEX) {
+    need = codec_hex_encoded_len(src_length);
+  } else if (encoding == PMI_ENCODING_BASE64) {
+    need = codec_base64_encoded_len(src_length);
+  } else {
+    DPRINTF ("%d: PMI_Encode (invalid encoding).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  /* the encoded string must still be representable as an int */
+  if (need >= (size_t) INT_MAX) {
+    DPRINTF ("%d: PMI_Encode (invalid length).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+  *out_length = (int) need;
+  if (length < 0 || (size_t) length < need + 1) {
+    DPRINTF ("%d: PMI_Encode (invalid length).\n", my_rank);
+    return PMI_ERR_INVALID_LENGTH;
+  }
+
+  if (encoding == PMI_ENCODING_HEX) {
+    codec_hex_encode((const uint8_t *) src, src_length, dst);
+  } else {
+    codec_base64_encode((const uint8_t *) src, src_length, dst);
+  }
+  dst[need] = '\0';
+  return PMI_SUCCESS;
+}
+
+extern "C" int PMI_Decode( int encoding, const char src[], int src_length, void *dst, int length, int *out_length )
+{
+  if ((src == NULL && src_length > 0) || src_length < 0
+      || (dst == NULL && length > 0) || out_length == NULL) {
+    DPRINTF ("%d: PMI_Decode (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_ARG;
+  }
+
+  int rc = decode_value(encoding, src, src_length, dst, length, out_length);
+  if (rc != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_Decode failed (%d).\n", my_rank, rc);
+  }
+  return rc;
+}
+
+extern "C" int PMI_KVS_Get_decoded( const char kvsname[], const char key[], int encoding, void *value, int length, int *out_length )
+{
+  /* check that we're initialized */
+  if (!initialized) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (PMI not initialized).\n", my_rank);
+    return PMI_ERR_INIT;
+  }
+
+  /* check length of name */
+  if (kvsname == NULL || strlen(kvsname) > MAX_KVS_LEN) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check that kvsname is the correct one */
+  kvs_space_t *space;
+  if ( (space = find_space(kvsname)) == NULL) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KVS;
+  }
+
+  /* check length of key */
+  if (key == NULL || strlen(key) > MAX_KEY_LEN) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_KEY;
+  }
+
+  /* check that we have somewhere to write to */
+  if ((value == NULL && length > 0) || out_length == NULL) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (invalid argument).\n", my_rank);
+    return PMI_ERR_INVALID_VAL;
+  }
+
+  /* decode straight out of the snapshot (or commit) bytes */
+  bool missing = true;
+  int rc = space->get(key, [&] (kv_str_t found) {
+    missing = false;
+    return decode_value(encoding, found.ptr, found.len, value, length, out_length);
+  });
+  if (missing) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded (ENOENT).\n", my_rank);
+    return PMI_FAIL;
+  }
+  if (rc != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI_KVS_Get_decoded failed (%d).\n", my_rank, rc);
+    return rc;
+  }
+
+  DPRINTF ("%d: PMI_KVS_Get_decoded succeeded.\n", my_rank);
   return PMI_SUCCESS;
 }
 
@@ -0,0 +1,466 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/* PMI-2 front end: the job's keyval space is the PMI-1 one, and node
+ * attributes live in a second space that is only ever fenced among the
+ * ranks of each node. So that they can be waited for without a fence,
+ * node attributes are also written to files in a directory the node's
+ * first rank makes at PMI2_Init, one file per attribute. */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "pmi.h"
+#include "pmi_ext.h"
+#include "pmi2.h"
+
+using namespace std;
+
+static bool initialized = false;
+static bool debug = false;
+static int ranks = -1;
+static int my_rank = -1;
+static char job_kvs[PMI2_MAX_VALLEN];
+static char node_kvs[PMI2_MAX_VALLEN];
+static vector<int> local_ranks;
+/* where the node attributes are written, empty if nowhere */
+static string node_dir;
+
+#define NODE_DIR_KEY "PMI2_MPI_node_dir"
+#define NODE_ATTR_MAX_IDLE_US 1000
+
+#ifndef DPRINTF
+ #define DPRINTF(fmt,...) do { \
+     if (debug) fprintf (stdout, fmt, ##__VA_ARGS__); \
+ } while (0)
+#endif
+
+/* look name up in kvsname; a missing key is not an error here */
+static int get_attr( const char *kvsname, const char name[], string &value, int *found )
+{
+  int max_len;
+  int rc = PMI_KVS_Get_value_length_max(&max_len);
+  if (rc != PMI_SUCCESS) {
+    return rc;
+  }
+  vector<char> buf (max_len + 1);
+  rc = PMI_KVS_Get(kvsname, name, buf.data(), max_len + 1);
+  *found = (rc == PMI_SUCCESS);
+  if (rc == PMI_FAIL) {
+    return PMI2_SUCCESS;
+  }
+  if (rc == PMI_SUCCESS) {
+    value = buf.data();
+  }
+  return rc;
+}
+
+static int copy_value( const string &value, char dst[], int length )
+{
+  if (dst == NULL || length < (int) value.size() + 1) {
+    return PMI2_ERR_INVALID_VAL_LENGTH;
+  }
+  memcpy(dst, value.c_str(), value.size() + 1);
+  return PMI2_SUCCESS;
+}
+
+/* parse a comma separated list of integers into array */
+static int copy_int_array( const string &value, int array[], int arraylen, int *outlen )
+{
+  const char *p = value.c_str();
+  int n = 0;
+  while (*p != '\0') {
+    char *end;
+    long v = strtol(p, &end, 10);
+    if (end == p || (*end != ',' && *end != '\0')) {
+      return PMI2_ERR_INVALID_VAL;
+    }
+    if (n == arraylen) {
+      return PMI2_ERR_INVALID_LENGTH;
+    }
+    array[n++] = (int) v;
+    p = *end == ',' ? end + 1 : end;
+  }
+  *outlen = n;
+  return PMI2_SUCCESS;
+}
+
+/* attribute names may hold any character, so files are named in hex */
+static string node_attr_path( const char name[] )
+{
+  size_t len = strlen(name);
+  string file (codec_hex_encoded_len(len), '\0');
+  codec_hex_encode((const uint8_t *) name, len, &file[0]);
+  return node_dir + "/" + file;
+}
+
+/* through a temporary file, so that readers see all of it or nothing */
+static int write_node_attr( const char name[], const char value[] )
+{
+  string path = node_attr_path(name);
+  string tmp = path + "." + to_string(my_rank);
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return PMI2_FAIL;
+  }
+  size_t len = strlen(value);
+  bool ok = write(fd, value, len) == (ssize_t) len;
+  if (close(fd) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return PMI2_FAIL;
+  }
+  return PMI2_SUCCESS;
+}
+
+static bool read_node_attr( const char name[], string &value )
+{
+  int fd = open(node_attr_path(name).c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  char buf[PMI2_MAX_VALLEN];
+  ssize_t n;
+  value.clear();
+  while ( (n = read(fd, buf, sizeof (buf))) > 0) {
+    value.append(buf, n);
+  }
+  close(fd);
+  return n == 0;
+}
+
+/* an attribute some process of the node put, whether fenced or not; with
+ * waitfor, poll until one does */
+static int get_node_attr( const char name[], string &value, int *found, int waitfor )
+{
+  long delay_us = 1;
+  for (;;) {
+    if (!node_dir.empty() && read_node_attr(name, value)) {
+      *found = 1;
+      return PMI2_SUCCESS;
+    }
+    int rc = get_attr(node_kvs, name, value, found);
+    if (rc != PMI2_SUCCESS || *found || !waitfor || node_dir.empty()) {
+      return rc;
+    }
+    struct timespec ts = { 0, delay_us * 1000 };
+    nanosleep(&ts, NULL);
+    if (delay_us < NODE_ATTR_MAX_IDLE_US) {
+      delay_us *= 2;
+    }
+  }
+}
+
+/* collective over the node: its first rank makes the directory and the
+ * others learn its name in a fence among them */
+static int make_node_dir( void )
+{
+  int rc;
+  if (local_ranks[0] == my_rank) {
+    const char *base = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+    string templ = string(base) + "/pmi2-node-XXXXXX";
+    vector<char> path (templ.begin(), templ.end());
+    path.push_back('\0');
+    if (mkdtemp(path.data()) != NULL) {
+      node_dir = path.data();
+    }
+    if ( (rc = PMI_KVS_Put(node_kvs, NODE_DIR_KEY, node_dir.c_str()))
+         != PMI_SUCCESS
+        || (rc = PMI_KVS_Commit(node_kvs)) != PMI_SUCCESS) {
+      return rc;
+    }
+  }
+  if ( (rc = PMI_KVS_Fence_group(node_kvs, local_ranks.data(),
+                                 local_ranks.size())) != PMI_SUCCESS) {
+    return rc;
+  }
+  int found;
+  if ( (rc = get_attr(node_kvs, NODE_DIR_KEY, node_dir, &found))
+       != PMI2_SUCCESS) {
+    return rc;
+  }
+  return PMI2_SUCCESS;
+}
+
+/* collective over the node, once no process reads the files any more */
+static void remove_node_dir( void )
+{
+  if (node_dir.empty()
+      || PMI_KVS_Fence_group(node_kvs, local_ranks.data(),
+                             local_ranks.size()) != PMI_SUCCESS
+      || local_ranks[0] != my_rank) {
+    return;
+  }
+  DIR *dir = opendir(node_dir.c_str());
+  struct dirent *d;
+  while (dir != NULL && (d = readdir(dir)) != NULL) {
+    if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+      unlink((node_dir + "/" + d->d_name).c_str());
+    }
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+  rmdir(node_dir.c_str());
+}
+
+static string local_ranks_list( void )
+{
+  string list;
+  for (size_t i = 0; i < local_ranks.size(); i++) {
+    list += (i ? "," : "") + to_string(local_ranks[i]);
+  }
+  return list;
+}
+
+extern "C" int PMI2_Init( int *spawned, int *out_size, int *out_rank, int *appnum )
+{
+  if (getenv ("PMI_MPI_DEBUG") != NULL) {
+    debug = true;
+  }
+  if (spawned == NULL || out_size == NULL || out_rank == NULL
+      || appnum == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  /* PMI-2 clients size their buffers by PMI2_MAX_VALLEN */
+  char max_val[32];
+  snprintf(max_val, sizeof (max_val), "%d", PMI2_MAX_VALLEN);
+  setenv("PMI_MPI_MAX_VAL_LEN", max_val, 0);
+
+  int rc, n;
+  if ( (rc = PMI_Init(spawned)) != PMI_SUCCESS
+      || (rc = PMI_Get_size(&ranks)) != PMI_SUCCESS
+      || (rc = PMI_Get_rank(&my_rank)) != PMI_SUCCESS
+      || (rc = PMI_Get_appnum(appnum)) != PMI_SUCCESS
+      || (rc = PMI_KVS_Get_my_name(job_kvs, sizeof (job_kvs))) != PMI_SUCCESS
+      || (rc = PMI_KVS_Create(node_kvs, sizeof (node_kvs))) != PMI_SUCCESS
+      || (rc = PMI_Get_clique_size(&n)) != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI2_Init failed (%d).\n", my_rank, rc);
+    return rc;
+  }
+  local_ranks.resize(n);
+  if ( (rc = PMI_Get_clique_ranks(local_ranks.data(), n)) != PMI_SUCCESS
+      || (rc = make_node_dir()) != PMI2_SUCCESS) {
+    return rc;
+  }
+
+  *out_size = ranks;
+  *out_rank = my_rank;
+  initialized = true;
+  DPRINTF ("%d: PMI2_Init succeeded.\n", my_rank);
+  return PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_Finalize( void )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  initialized = false;
+  remove_node_dir();
+  return PMI_Finalize();
+}
+
+extern "C" int PMI2_Initialized( void )
+{
+  return initialized;
+}
+
+extern "C" int PMI2_Abort( int flag, const char msg[] )
+{
+  /* PMI_Abort takes the whole job down either way once MPI has started,
+   * and only this process before */
+  return PMI_Abort(1, msg);
+}
+
+extern "C" int PMI2_Job_GetId( char jobid[], int jobid_size )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  return copy_value(job_kvs, jobid, jobid_size) == PMI2_SUCCESS
+         ? PMI2_SUCCESS : PMI2_ERR_INVALID_LENGTH;
+}
+
+extern "C" int PMI2_Job_GetRank( int *rank )
+{
+  return PMI_Get_rank(rank);
+}
+
+extern "C" int PMI2_Info_GetSize( int *out_size )
+{
+  return PMI_Get_size(out_size);
+}
+
+extern "C" int PMI2_KVS_Put( const char key[], const char value[] )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  return PMI_KVS_Put(job_kvs, key, value);
+}
+
+extern "C" int PMI2_KVS_Fence( void )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+
+  /* the nodes are disjoint, so their fences need no common order */
+  int rc;
+  if ( (rc = PMI_KVS_Commit(job_kvs)) != PMI_SUCCESS
+      || (rc = PMI_KVS_Commit(node_kvs)) != PMI_SUCCESS
+      || (rc = PMI_KVS_Fence(job_kvs)) != PMI_SUCCESS
+      || (rc = PMI_KVS_Fence_group(node_kvs, local_ranks.data(),
+                                   local_ranks.size())) != PMI_SUCCESS) {
+    DPRINTF ("%d: PMI2_KVS_Fence failed (%d).\n", my_rank, rc);
+    return rc;
+  }
+  return PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_KVS_Get( const char *jobid, int src_pmi_id, const char key[], char value [], int maxvalue, int *vallen )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (jobid != NULL && strcmp(jobid, job_kvs) != 0) {
+    DPRINTF ("%d: PMI2_KVS_Get (unknown job %s).\n", my_rank, jobid);
+    return PMI2_ERR_INVALID_ARG;
+  }
+  if (vallen == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  int rc = PMI_KVS_Get(job_kvs, key, value, maxvalue);
+  if (rc == PMI_ERR_INVALID_LENGTH) {
+    return PMI2_ERR_INVALID_VAL_LENGTH;
+  }
+  if (rc != PMI_SUCCESS) {
+    return rc;
+  }
+  *vallen = strlen(value);
+  return PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_Info_GetNodeAttr( const char name[], char value[], int valuelen, int *found, int waitfor )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (name == NULL || found == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  string attr;
+  int rc = PMI2_SUCCESS;
+  if (strcmp(name, "localRanksCount") == 0) {
+    attr = to_string(local_ranks.size());
+    *found = 1;
+  } else if (strcmp(name, "localRanks") == 0) {
+    attr = local_ranks_list();
+    *found = 1;
+  } else if ( (rc = get_node_attr(name, attr, found, waitfor)) != PMI2_SUCCESS) {
+    return rc == PMI_ERR_INVALID_LENGTH ? PMI2_ERR_INVALID_VAL_LENGTH : rc;
+  }
+  return *found ? copy_value(attr, value, valuelen) : PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_Info_GetNodeAttrIntArray( const char name[], int array[], int arraylen, int *outlen, int *found )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (name == NULL || array == NULL || outlen == NULL || found == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  string attr;
+  int rc;
+  if (strcmp(name, "localRanksCount") == 0) {
+    attr = to_string(local_ranks.size());
+    *found = 1;
+  } else if (strcmp(name, "localRanks") == 0) {
+    attr = local_ranks_list();
+    *found = 1;
+  } else if ( (rc = get_node_attr(name, attr, found, 0)) != PMI2_SUCCESS) {
+    return rc;
+  }
+  return *found ? copy_int_array(attr, array, arraylen, outlen) : PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_Info_PutNodeAttr( const char name[], const char value[] )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (name == NULL || value == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+  int rc = PMI_KVS_Put(node_kvs, name, value);
+  if (rc == PMI_SUCCESS && !node_dir.empty()) {
+    rc = write_node_attr(name, value);
+  }
+  return rc;
+}
+
+extern "C" int PMI2_Info_GetJobAttr( const char name[], char value[], int valuelen, int *found )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (name == NULL || found == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  string attr;
+  int rc;
+  if (strcmp(name, "universeSize") == 0) {
+    int universe;
+    if ( (rc = PMI_Get_universe_size(&universe)) != PMI_SUCCESS) {
+      return rc;
+    }
+    attr = to_string(universe);
+    *found = 1;
+  } else if ( (rc = get_attr(job_kvs, name, attr, found)) != PMI2_SUCCESS) {
+    return rc == PMI_ERR_INVALID_LENGTH ? PMI2_ERR_INVALID_VAL_LENGTH : rc;
+  }
+  return *found ? copy_value(attr, value, valuelen) : PMI2_SUCCESS;
+}
+
+extern "C" int PMI2_Info_GetJobAttrIntArray( const char name[], int array[], int arraylen, int *outlen, int *found )
+{
+  if (!initialized) {
+    return PMI2_ERR_INIT;
+  }
+  if (name == NULL || array == NULL || outlen == NULL || found == NULL) {
+    return PMI2_ERR_INVALID_ARG;
+  }
+
+  string attr;
+  int rc;
+  if ( (rc = get_attr(job_kvs, name, attr, found)) != PMI2_SUCCESS) {
+    return rc;
+  }
+  return *found ? copy_int_array(attr, array, arraylen, outlen) : PMI2_SUCCESS;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,243 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * pmi2.h - the PMI-2 interface, as used by MPICH derived MPI libraries,
+ * provided by this libpmi.so on top of the same keyval spaces as PMI-1.
+ * Process spawning, job connection and the name service are not
+ * provided.
+ */
+
+#ifndef PMI2_H
+#define PMI2_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define PMI2_MAX_KEYLEN 64
+#define PMI2_MAX_VALLEN 1024
+#define PMI2_MAX_ATTRVALUE 1024
+#define PMI2_ID_NULL -1
+
+/* the same values as the PMI-1 codes */
+#define PMI2_SUCCESS                  0
+#define PMI2_FAIL                    -1
+#define PMI2_ERR_INIT                 1
+#define PMI2_ERR_NOMEM                2
+#define PMI2_ERR_INVALID_ARG          3
+#define PMI2_ERR_INVALID_KEY          4
+#define PMI2_ERR_INVALID_KEY_LENGTH   5
+#define PMI2_ERR_INVALID_VAL          6
+#define PMI2_ERR_INVALID_VAL_LENGTH   7
+#define PMI2_ERR_INVALID_LENGTH       8
+#define PMI2_ERR_INVALID_NUM_ARGS     9
+#define PMI2_ERR_INVALID_ARGS        10
+#define PMI2_ERR_INVALID_NUM_PARSED  11
+#define PMI2_ERR_INVALID_KEYVALP     12
+#define PMI2_ERR_INVALID_SIZE        13
+#define PMI2_ERR_OTHER               14
+
+/*@
+PMI2_Init - initialize the Process Manager Interface
+
+Output Parameters:
++ spawned - spawned flag
+. size - number of processes in the job
+. rank - rank of this process in the job
+- appnum - which executable is this on the mpiexec commandline
+
+Return values:
+Returns 'PMI2_SUCCESS' on success and an PMI error code on failure.
+
+Notes:
+Collective over the job. Unless PMI_MPI_MAX_VAL_LEN is set, values of up
+to PMI2_MAX_VALLEN bytes may be put.
+
+@*/
+int PMI2_Init( int *spawned, int *size, int *rank, int *appnum );
+
+/*@
+PMI2_Finalize - finalize the Process Manager Interface
+
+@*/
+int PMI2_Finalize( void );
+
+/*@
+PMI2_Initialized - check if PMI has been initialized
+
+Return values:
+Non-zero if PMI2_Init has been called successfully, zero otherwise.
+
+@*/
+int PMI2_Initialized( void );
+
+/*@
+PMI2_Abort - abort the process group associated with this process
+
+Input Parameters:
++ flag - non-zero if all processes in this job should abort, zero otherwise
+- error_msg - error message to be printed
+
+@*/
+int PMI2_Abort( int flag, const char msg[] );
+
+/*@
+PMI2_Job_GetId - get the job id of this job
+
+Input Parameters:
+. jobid_size - size of the buffer provided in jobid
+
+Output Parameters:
+. jobid - the job id of this job
+
+@*/
+int PMI2_Job_GetId( char jobid[], int jobid_size );
+
+/*@
+PMI2_Job_GetRank - get the rank of this process in the job
+
+@*/
+int PMI2_Job_GetRank( int *rank );
+
+/*@
+PMI2_Info_GetSize - get the number of processes in the job
+
+@*/
+int PMI2_Info_GetSize( int *size );
+
+/*@
+PMI2_KVS_Put - put a key/value pair in the keyval space of this job
+
+Input Parameters:
++ key - key
+- value - value
+
+Notes:
+The pair is visible to other processes after the next 'PMI2_KVS_Fence()';
+there is no separate commit.
+
+@*/
+int PMI2_KVS_Put( const char key[], const char value[] );
+
+/*@
+PMI2_KVS_Fence - make the pairs put by all processes visible everywhere
+
+Notes:
+Collective over the job. Node attributes put since the last fence are
+exchanged at the same time, among the processes of each node only.
+
+@*/
+int PMI2_KVS_Fence( void );
+
+/*@
+PMI2_KVS_Get - get a value from a keyval space
+
+Input Parameters:
++ jobid - the job id, or NULL for this job
+. src_pmi_id - rank of the process that put the value, or PMI2_ID_NULL
+. key - key
+- maxvalue - size of the value buffer
+
+Output Parameters:
++ value - the value, NUL terminated
+- vallen - length of the value, without the NUL
+
+Notes:
+src_pmi_id is only a hint and is not used.
+
+@*/
+int PMI2_KVS_Get( const char *jobid, int src_pmi_id, const char key[], char value [], int maxvalue, int *vallen );
+
+/*@
+PMI2_Info_GetNodeAttr - get an attribute of the node of this process
+
+Input Parameters:
++ name - attribute name
+. valuelen - size of the value buffer
+- waitfor - if non-zero, wait until a process of the node puts the attribute
+
+Output Parameters:
++ value - the value, NUL terminated
+- found - non-zero if the attribute was found
+
+Notes:
+"localRanksCount" and "localRanks" (a comma separated list) describe the
+processes on the node and are always found. Attributes put with
+'PMI2_Info_PutNodeAttr()' by other processes of the node are found as
+soon as they are put, with no fence: they are kept in files of a
+directory under /dev/shm (or /tmp), which PMI2_Finalize removes.
+
+@*/
+int PMI2_Info_GetNodeAttr( const char name[], char value[], int valuelen, int *found, int waitfor );
+
+/*@
+PMI2_Info_GetNodeAttrIntArray - get a node attribute that is a list of integers
+
+Input Parameters:
++ name - attribute name
+- arraylen - size of the array
+
+Output Parameters:
++ array - the integers
+. outlen - number of integers stored
+- found - non-zero if the attribute was found
+
+@*/
+int PMI2_Info_GetNodeAttrIntArray( const char name[], int array[], int arraylen, int *outlen, int *found );
+
+/*@
+PMI2_Info_PutNodeAttr - share an attribute with the processes of this node
+
+Input Parameters:
++ name - attribute name
+- value - value
+
+@*/
+int PMI2_Info_PutNodeAttr( const char name[], const char value[] );
+
+/*@
+PMI2_Info_GetJobAttr - get an attribute of the job
+
+Input Parameters:
++ name - attribute name
+- valuelen - size of the value buffer
+
+Output Parameters:
++ value - the value, NUL terminated
+- found - non-zero if the attribute was found
+
+Notes:
+"universeSize", "PMI_process_mapping" and the job attributes listed in
+pmi_ext.h are found without any fence.
+
+@*/
+int PMI2_Info_GetJobAttr( const char name[], char value[], int valuelen, int *found );
+
+/*@
+PMI2_Info_GetJobAttrIntArray - get a job attribute that is a list of integers
+
+Input Parameters:
++ name - attribute name
+- arraylen - size of the array
+
+Output Parameters:
++ array - the integers
+. outlen - number of integers stored
+- found - non-zero if the attribute was found
+
+@*/
+int PMI2_Info_GetJobAttrIntArray( const char name[], int array[], int arraylen, int *outlen, int *found );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* PMI2_H */
@@ -0,0 +1,103 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/* cases for the PMI-2 interface in pmi2.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pmi2.h"
+
+static int rank = 0, size = 0;
+static char jobid[PMI2_MAX_VALLEN];
+
+/* a value put by every rank, read back by every rank after a fence */
+static int put_fence_get (void)
+{
+    int grc = 0, r, len;
+    char key[PMI2_MAX_KEYLEN], val[PMI2_MAX_VALLEN], got[PMI2_MAX_VALLEN];
+
+    snprintf (key, sizeof (key), "p2-%d", rank);
+    memset (val, 'a' + rank % 26, 1000);
+    val[1000] = '\0';
+    if (PMI2_KVS_Put (key, val) != PMI2_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI2_KVS_Put: \n", rank); grc++;
+    }
+    if (PMI2_KVS_Fence () != PMI2_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI2_KVS_Fence: \n", rank); grc++;
+    }
+    for (r = 0; r < size; r++) {
+        snprintf (key, sizeof (key), "p2-%d", r);
+        memset (val, 'a' + r % 26, 1000);
+        if (PMI2_KVS_Get (jobid, PMI2_ID_NULL, key, got, sizeof (got), &len) != PMI2_SUCCESS
+            || len != 1000 || strcmp (got, val) != 0) {
+            fprintf (stderr, "%d: [error] PMI2_KVS_Get: key(%s)\n", rank, key); grc++;
+        }
+    }
+    return grc;
+}
+
+/* the first rank of each node puts an attribute while the others already
+ * wait for it, with no fence between them */
+static int node_attr_waitfor (void)
+{
+    int grc = 0, found = 0, n = 0, local[PMI2_MAX_VALLEN];
+    char val[PMI2_MAX_VALLEN], want[64];
+
+    if (PMI2_Info_GetNodeAttrIntArray ("localRanks", local, PMI2_MAX_VALLEN, &n, &found)
+        != PMI2_SUCCESS || !found || n < 1) {
+        fprintf (stderr, "%d: [error] PMI2_Info_GetNodeAttrIntArray: localRanks\n", rank);
+        return 1;
+    }
+    snprintf (want, sizeof (want), "shm-of-%d", local[0]);
+    if (local[0] == rank) {
+        usleep (100000);
+        if (PMI2_Info_PutNodeAttr ("shm name", want) != PMI2_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI2_Info_PutNodeAttr: \n", rank); grc++;
+        }
+    } else if (PMI2_Info_GetNodeAttr ("shm name", val, sizeof (val), &found, 1)
+               != PMI2_SUCCESS || !found || strcmp (val, want) != 0) {
+        fprintf (stderr, "%d: [error] PMI2_Info_GetNodeAttr: waitfor\n", rank); grc++;
+    }
+    if (PMI2_Info_GetNodeAttr ("no such attr", val, sizeof (val), &found, 0)
+        != PMI2_SUCCESS || found) {
+        fprintf (stderr, "%d: [error] PMI2_Info_GetNodeAttr: no such attr\n", rank); grc++;
+    }
+    return grc;
+}
+
+int main (int argc, char *argv[])
+{
+    int grc = 0, spawned = 0, appnum = 0;
+
+    if (PMI2_Init (&spawned, &size, &rank, &appnum) != PMI2_SUCCESS) {
+        fprintf (stderr, "PMI2_Init:\n"); grc++;
+    }
+    if (PMI2_Job_GetId (jobid, sizeof (jobid)) != PMI2_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI2_Job_GetId: \n", rank); grc++;
+    }
+
+    grc += put_fence_get ();
+    grc += node_attr_waitfor ();
+
+    if (PMI2_Finalize () != PMI2_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI2_Finalize: \n", rank);
+        grc++;
+    }
+
+    if (grc != 0) {
+        fprintf (stdout, "%d: FAILED\n", rank);
+    } else {
+        fprintf (stdout, "%d: SUCCESS\n", rank);
+    }
+
+    return grc != 0;
+}
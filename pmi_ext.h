@@ -0,0 +1,402 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * pmi_ext.h - extensions to the PMI-1 interface provided by this libpmi.so.
+ * Return values follow the PMI_SUCCESS/PMI_ERR_* conventions of pmi.h.
+ *
+ * All PMI calls of this libpmi.so may be made from several threads at
+ * once. Puts and Gets of different threads proceed in parallel (Gets do
+ * not lock unless there are commits not yet fenced); a Put is made
+ * visible by the next PMI_KVS_Commit from any thread.
+ *
+ * When the launcher passes each process its rank and the job size
+ * (jsrun, Open MPI's mpirun or srun), PMI_Init returns without starting
+ * MPI, and rank, size and appnum queries are answered from them. MPI is
+ * started by the first call that needs it, which every process of the
+ * job must then make sooner or later; a job that never makes one never
+ * starts MPI.
+ *
+ * With PMI_MPI_SNAPSHOT_DIR set to a node-local directory, one process
+ * per node saves the keyval spaces there at PMI_Finalize, named after the
+ * job id, size and process mapping. The next job step of the same shape
+ * maps them read-only when it opens its spaces (if every node has the
+ * same ones), and a fence in which every process only commits values the
+ * snapshot already holds skips the exchange. Gets see nothing of the
+ * snapshot before the first fence, which publishes it if it skipped the
+ * exchange and drops it otherwise.
+ *
+ * With PMI_MPI_MEM_BUDGET set to a size in bytes (a K, M or G suffix
+ * scales it), a full fence that leaves a keyval space larger than that
+ * keeps only part of it: the keys this process is home to (the process
+ * a per-rank template key names, a hash of the key for the others), its
+ * own template values and the keys it fetched before. A Get of any other
+ * key fetches it from its home, a round trip to that process, and keeps
+ * it until the next fence. Spaces that were ever fenced by group, by
+ * sources or with values for particular ranks are not trimmed, nor are
+ * trimmed spaces saved for the next step. Needs MPI_THREAD_MULTIPLE;
+ * PMI_MPI_STATS reports resident bytes, evictions and fetch latency.
+ *
+ * PMI_MPI_DECODE_THREADS sets the threads that decode the values a
+ * fence brings in. The images of a fence are cut into segments of about
+ * a megabyte, so a large one is spread over the threads as well as
+ * several smaller ones.
+ *
+ * The job's keyval space answers these keys without any put or fence,
+ * unless a value was put under them:
+ *   PMI_process_mapping - node layout of the ranks, in MPICH's
+ *                         "(vector,(node,nodes,ranks per node),...)" form
+ *   PMI_MPI_node_id     - node of this rank, numbered in order of the
+ *                         lowest rank on each
+ *   PMI_MPI_num_nodes   - number of nodes of the job
+ *   PMI_MPI_local_rank  - position of this rank among those on its node
+ *   PMI_MPI_local_size  - number of ranks on this rank's node
+ */
+
+#ifndef PMI_EXT_H
+#define PMI_EXT_H
+
+#include "pmi.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*@
+PMI_KVS_Register_rank_key - store keys of a per-rank template in a column
+
+Input Parameters:
++ kvsname - keyval space name
+- key_template - key containing exactly one '%d', e.g. "key-from-%d"
+
+Return values:
++ PMI_SUCCESS - template registered
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+- PMI_ERR_INVALID_KEY - template is too long or does not contain one '%d'
+
+Notes:
+Keys of the form '<prefix><r><suffix>', where r is a rank of the job written
+in plain decimal, are then stored in a dense per-rank array: 'PMI_KVS_Get()'
+of such a key is a direct index, and fences ship only the values, not the
+keys. Register the template on every rank before putting any matching key;
+keys put before the registration remain ordinary keys.
+
+@*/
+int PMI_KVS_Register_rank_key( const char kvsname[], const char key_template[] );
+
+/*@
+PMI_KVS_Put_bytes - put a binary value in a keyval space
+
+Input Parameters:
++ kvsname - keyval space name
+. key - key
+. value - value bytes (need not be NUL terminated, may contain NULs)
+- length - number of bytes in value, at most the value length maximum
+
+Return values:
++ PMI_SUCCESS - keyval pair successfully put in keyval space
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_KEY - invalid key argument
+. PMI_ERR_INVALID_VAL_LENGTH - invalid value or length argument
+- PMI_ERR_NOMEM - out of memory
+
+Notes:
+Same semantics as 'PMI_KVS_Put()', but the value is carried as raw bytes
+through commit and fence, so endpoint addresses need not be hex or base64
+encoded to fit the string interface.
+
+@*/
+int PMI_KVS_Put_bytes( const char kvsname[], const char key[], const void *value, int length );
+
+/*@
+PMI_KVS_Get_bytes - get a binary value from a keyval space
+
+Input Parameters:
++ kvsname - keyval space name
+. key - key
+- length - size of the value buffer
+
+Output Parameters:
++ value - value bytes (not NUL terminated)
+- out_length - number of bytes in the value
+
+Return values:
++ PMI_SUCCESS - get succeeded
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_KEY - invalid key argument
+. PMI_ERR_INVALID_VAL - invalid value or out_length argument
+. PMI_ERR_INVALID_LENGTH - buffer too small; out_length holds the size needed
+- PMI_FAIL - key not found
+
+Notes:
+Works for values put by either 'PMI_KVS_Put()' (the string without its NUL)
+or 'PMI_KVS_Put_bytes()'. 'PMI_KVS_Get()' of a binary value returns the bytes
+followed by a NUL.
+
+@*/
+int PMI_KVS_Get_bytes( const char kvsname[], const char key[], void *value, int length, int *out_length );
+
+#define PMI_ENCODING_HEX 1
+#define PMI_ENCODING_BASE64 2
+
+/*@
+PMI_Encode - encode binary data as a printable string
+
+Input Parameters:
++ encoding - PMI_ENCODING_HEX or PMI_ENCODING_BASE64
+. src - bytes to encode
+. src_length - number of bytes in src
+- length - size of the dst buffer
+
+Output Parameters:
++ dst - NUL terminated encoded string
+- out_length - length of the encoded string, not counting the NUL
+
+Return values:
++ PMI_SUCCESS - src encoded
+. PMI_ERR_INVALID_ARG - unknown encoding or invalid src or dst argument
+- PMI_ERR_INVALID_LENGTH - dst too small; out_length holds the length needed
+
+Notes:
+Hex output is lower case. Base64 output uses the RFC 4648 alphabet with
+padding. Does not require 'PMI_Init()'; the SSSE3 or AVX2 implementation is
+used when the CPU supports it.
+
+@*/
+int PMI_Encode( int encoding, const void *src, int src_length, char dst[], int length, int *out_length );
+
+/*@
+PMI_Decode - decode a string produced by PMI_Encode
+
+Input Parameters:
++ encoding - PMI_ENCODING_HEX or PMI_ENCODING_BASE64
+. src - encoded string
+. src_length - length of src, not counting any NUL
+- length - size of the dst buffer
+
+Output Parameters:
++ dst - decoded bytes
+- out_length - number of decoded bytes
+
+Return values:
++ PMI_SUCCESS - src decoded
+. PMI_ERR_INVALID_ARG - unknown encoding or invalid src or dst argument
+. PMI_ERR_INVALID_VAL - src is not valid in the encoding
+- PMI_ERR_INVALID_LENGTH - dst too small; out_length holds the size needed
+
+Notes:
+Hex input may be in either case.
+
+@*/
+int PMI_Decode( int encoding, const char src[], int src_length, void *dst, int length, int *out_length );
+
+/*@
+PMI_KVS_Get_decoded - get a value and decode it in one step
+
+Input Parameters:
++ kvsname - keyval space name
+. key - key
+. encoding - PMI_ENCODING_HEX or PMI_ENCODING_BASE64
+- length - size of the value buffer
+
+Output Parameters:
++ value - decoded value bytes
+- out_length - number of decoded bytes
+
+Return values:
++ PMI_SUCCESS - get succeeded
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_KEY - invalid key argument
+. PMI_ERR_INVALID_ARG - unknown encoding
+. PMI_ERR_INVALID_VAL - invalid value or out_length argument, or the stored
+  value is not valid in the encoding
+. PMI_ERR_INVALID_LENGTH - buffer too small; out_length holds the size needed
+- PMI_FAIL - key not found
+
+Notes:
+Equivalent to 'PMI_KVS_Get()' followed by 'PMI_Decode()', but decodes
+straight from the published KVS without an intermediate string copy.
+
+@*/
+int PMI_KVS_Get_decoded( const char kvsname[], const char key[], int encoding, void *value, int length, int *out_length );
+
+/*@
+PMI_KVS_Put_to - put a key/value pair for some ranks only
+
+Input Parameters:
++ kvsname - keyval space name
+. key - key
+. value - value
+. ranks - ranks that will read the value, in any order
+- count - number of ranks
+
+Return values:
++ PMI_SUCCESS - keyval pair successfully put
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_KEY - invalid key argument
+. PMI_ERR_INVALID_VAL - invalid value argument
+. PMI_ERR_INVALID_ARG - no ranks, or ranks out of range
+- PMI_ERR_NOMEM - out of memory
+
+Notes:
+The pair is sent by the next 'PMI_Barrier()' or 'PMI_KVS_Fence()' of the
+space straight to the ranks named, and only they can get it afterwards;
+it takes no room in what the fence sends to everyone else. It needs no
+'PMI_KVS_Commit()', and group and sparse fences leave it waiting. A pair
+put for a rank overrides, on that rank, a value committed for everyone
+under the same key in the same fence. Of pairs put for a rank under one
+key by several ranks in the same fence, that of the highest rank wins.
+
+@*/
+int PMI_KVS_Put_to( const char kvsname[], const char key[], const char value[], const int ranks[], int count );
+
+/*@
+PMI_KVS_Fence - make the commits to one keyval space visible everywhere
+
+Input Parameters:
+. kvsname - keyval space name
+
+Return values:
++ PMI_SUCCESS - fence successfully finished
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+- PMI_FAIL - fence failed
+
+Notes:
+'PMI_Barrier()' fences every keyval space; this fences only the one named,
+so spaces used by different parts of a program can be exchanged
+independently, and from different threads at the same time if the MPI
+library provides MPI_THREAD_MULTIPLE. Otherwise fences of different
+spaces take turns, and all processes must fence them in the same order.
+
+Like 'PMI_Barrier()', this is collective over the process group, as are
+'PMI_KVS_Create()' and 'PMI_KVS_Destroy()' in this implementation: each
+space has an MPI communicator of its own. All processes must create spaces
+in the same order, and get the same names for them. Up to 64 spaces may
+be created over the life of the job, including the job's own.
+
+@*/
+int PMI_KVS_Fence( const char kvsname[] );
+
+/*@
+PMI_KVS_Fence_group - exchange the commits to a keyval space among some ranks
+
+Input Parameters:
++ kvsname - keyval space name
+. ranks - ranks of the group, in any order, including the caller's
+- count - number of ranks
+
+Return values:
++ PMI_SUCCESS - fence successfully finished
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_ARG - ranks are out of range, repeated or omit the caller
+- PMI_FAIL - fence failed
+
+Notes:
+This is 'PMI_KVS_Fence()' among the ranks listed only, and collective over
+them alone: every member must pass the same set of ranks, and the other
+ranks of the job take no part. Values committed by the members since the
+last fence become visible to the members, and to no one else; a later
+fence of the whole space does not send them again. Groups that overlap
+must be fenced in the same order by the ranks they share.
+
+The first fence of a group creates an MPI communicator for it, which is
+kept until the space is destroyed, so that repeated fences of the same
+group cost no more than exchanging their values.
+
+@*/
+int PMI_KVS_Fence_group( const char kvsname[], const int ranks[], int count );
+
+/*@
+PMI_KVS_Set_sources - declare whose values a rank reads at sparse fences
+
+Input Parameters:
++ kvsname - keyval space name
+. ranks - ranks whose commits this rank needs, in any order
+- count - number of ranks, may be 0
+
+Return values:
++ PMI_SUCCESS - sources set
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+. PMI_ERR_INVALID_ARG - ranks are out of range
+- PMI_FAIL - the exchange pattern could not be set up
+
+Notes:
+Collective over the process group. Each rank names its own sources, which
+replace those it set before; from them, every rank learns which ranks
+read its values. The pattern holds for all later calls of
+'PMI_KVS_Fence_sparse()' on the space until sources are set again.
+
+@*/
+int PMI_KVS_Set_sources( const char kvsname[], const int ranks[], int count );
+
+/*@
+PMI_KVS_Fence_sparse - deliver commits only to the ranks that read them
+
+Input Parameters:
+. kvsname - keyval space name
+
+Return values:
++ PMI_SUCCESS - fence successfully finished
+. PMI_ERR_INIT - PMI not initialized
+. PMI_ERR_INVALID_KVS - invalid kvsname argument
+- PMI_FAIL - fence failed, or no sources were set for the space
+
+Notes:
+Like 'PMI_KVS_Fence()', but the values committed by a rank since the last
+fence go only to the ranks that named it in 'PMI_KVS_Set_sources()', in
+one neighborhood exchange. A rank then exchanges data with its sources
+and readers only, rather than receiving the values of the whole job.
+A later fence of the whole space does not send these values again.
+
+@*/
+int PMI_KVS_Fence_sparse( const char kvsname[] );
+
+/*@
+PMI_Barrier_start - start a barrier without waiting for it
+
+Return values:
++ PMI_SUCCESS - barrier started
+. PMI_ERR_INIT - PMI not initialized
+- PMI_FAIL - a barrier started earlier has not been waited for
+
+Notes:
+Together with 'PMI_Barrier_wait()', this is 'PMI_Barrier()' split in two.
+Only with PMI_MPI_PROGRESS set in the environment does the barrier make
+progress in between, on a helper thread; otherwise it completes within
+'PMI_Barrier_start()'. Values fenced by it are visible once
+'PMI_Barrier_wait()' returns; until then Gets see the previous fence. Gets
+from a space with nothing committed since its last fence return at once;
+other Gets, and Commits and rank key registrations, wait for the barrier
+while it runs.
+
+@*/
+int PMI_Barrier_start( void );
+
+/*@
+PMI_Barrier_wait - wait for the barrier started by PMI_Barrier_start
+
+Return values:
++ PMI_SUCCESS - barrier successfully finished
+. PMI_ERR_INIT - PMI not initialized
+- PMI_FAIL - barrier failed, or none was started
+
+@*/
+int PMI_Barrier_wait( void );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* PMI_EXT_H */
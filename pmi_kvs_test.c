@@ -0,0 +1,625 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/* cases for the extensions in pmi_ext.h, each in the job's own space
+ * under keys of its own
+ *
+ * Usage: pmi_kvs_test [lazy | idle | budget]
+ *        pmi_kvs_test persist | restore | restore-changed DIR
+ *
+ * lazy and idle run only the lazy start case, the first ending in a put
+ * and a barrier, the second in PMI_Finalize with nothing communicated.
+ * budget runs only the memory budget case, under a budget small enough
+ * that values are evicted and fetched again.
+ * The others run one step each of the snapshot case, with its snapshots
+ * kept in DIR; they are meant to be run in that order, at one size. */
+
+#define _GNU_SOURCE /* RTLD_DEFAULT */
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pmi.h"
+#include "pmi_ext.h"
+
+static int rank = 0, size = 0;
+static char kvsname[256];
+
+static int expect (const char *key, const char *want)
+{
+    char got[256];
+    int rc = PMI_KVS_Get (kvsname, key, got, sizeof (got));
+    if (rc != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Get: key(%s) rc (%d)\n", rank, key, rc);
+        return 1;
+    }
+    if (strcmp (got, want) != 0) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Get: key(%s)=val(%s), not %s\n", rank, key, got, want);
+        return 1;
+    }
+    return 0;
+}
+
+static int expect_missing (const char *key)
+{
+    char got[256];
+    if (PMI_KVS_Get (kvsname, key, got, sizeof (got)) == PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Get: key(%s)=val(%s) visible\n", rank, key, got);
+        return 1;
+    }
+    return 0;
+}
+
+/* a value put for one rank under a registered template key */
+static int put_to_rank_key (void)
+{
+    int grc = 0, right = (rank + 1) % size, left = (size + rank - 1) % size;
+    char key[64], val[64];
+
+    if (PMI_KVS_Register_rank_key (kvsname, "tc-%d") != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Register_rank_key: \n", rank); grc++;
+    }
+    snprintf (key, sizeof (key), "tc-%d", rank);
+    snprintf (val, sizeof (val), "tc-val-%d", rank);
+    if (PMI_KVS_Put_to (kvsname, key, val, &right, 1) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put_to: \n", rank); grc++;
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    snprintf (key, sizeof (key), "tc-%d", left);
+    snprintf (val, sizeof (val), "tc-val-%d", left);
+    grc += expect (key, val);
+    return grc;
+}
+
+/* a value put for one rank reaches that rank alone; values put for one
+ * rank under the same key by several ranks resolve to the highest rank's */
+static int put_to_routing (void)
+{
+    int grc = 0, r, right = (rank + 1) % size, target = 0;
+    char key[64], val[64];
+
+    snprintf (key, sizeof (key), "rt-%d", rank);
+    snprintf (val, sizeof (val), "rt-val-%d", rank);
+    if (PMI_KVS_Put_to (kvsname, key, val, &right, 1) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put_to: \n", rank); grc++;
+    }
+    snprintf (val, sizeof (val), "rt-from-%d", rank);
+    if (PMI_KVS_Put_to (kvsname, "rt-same", val, &target, 1) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put_to: \n", rank); grc++;
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    for (r = 0; r < size; r++) {
+        snprintf (key, sizeof (key), "rt-%d", r);
+        snprintf (val, sizeof (val), "rt-val-%d", r);
+        grc += (r + 1) % size == rank ? expect (key, val) : expect_missing (key);
+    }
+    snprintf (val, sizeof (val), "rt-from-%d", size - 1);
+    grc += rank == target ? expect ("rt-same", val) : expect_missing ("rt-same");
+    return grc;
+}
+
+/* keys put before their template was registered stay readable once some
+ * of the template's keys are put again */
+static int rank_key_registered_late (void)
+{
+    int grc = 0, r;
+    char key[64], val[64];
+
+    snprintf (key, sizeof (key), "bc-%d", rank);
+    snprintf (val, sizeof (val), "bc-val-%d", rank);
+    if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS
+        || PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+        || PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+    }
+    if (PMI_KVS_Register_rank_key (kvsname, "bc-%d") != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Register_rank_key: \n", rank); grc++;
+    }
+    if (rank == 0 && (PMI_KVS_Put (kvsname, "bc-0", "bc-new-0") != PMI_SUCCESS
+                      || PMI_KVS_Commit (kvsname) != PMI_SUCCESS)) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    grc += expect ("bc-0", "bc-new-0");
+    for (r = 1; r < size; r++) {
+        snprintf (key, sizeof (key), "bc-%d", r);
+        snprintf (val, sizeof (val), "bc-val-%d", r);
+        grc += expect (key, val);
+    }
+    return grc;
+}
+
+/* a value put for one rank in a fence that also brings every rank
+ * thousands of values put for all */
+static int put_to_busy_fence (void)
+{
+    int grc = 0, i, right = (rank + 1) % size;
+    char key[64], val[256];
+
+    for (i = rank; i < 12000; i += size) {
+        snprintf (key, sizeof (key), "pub-%d", i);
+        snprintf (val, sizeof (val), "%0200d", i);
+        if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+            break;
+        }
+    }
+    snprintf (key, sizeof (key), "to-%d", right);
+    if (PMI_KVS_Put_to (kvsname, key, "to-val", &right, 1) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put_to: \n", rank); grc++;
+    }
+    if (PMI_KVS_Commit (kvsname) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Commit: \n", rank); grc++;
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    snprintf (key, sizeof (key), "to-%d", rank);
+    grc += expect (key, "to-val");
+    for (i = 0; i < 12000; i += 997) {
+        snprintf (key, sizeof (key), "pub-%d", i);
+        snprintf (val, sizeof (val), "%0200d", i);
+        grc += expect (key, val);
+    }
+    return grc;
+}
+
+/* even and odd ranks fence as two groups at once; what a group exchanged
+ * stays with it, even after a fence of the whole space */
+static int fence_group_members (void)
+{
+    int grc = 0, r, n = 0, group[size];
+    char key[64], val[64];
+
+    for (r = rank % 2; r < size; r += 2) {
+        group[n++] = r;
+    }
+    snprintf (key, sizeof (key), "grp-%d", rank);
+    snprintf (val, sizeof (val), "grp-val-%d", rank);
+    if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS
+        || PMI_KVS_Commit (kvsname) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+    }
+    if (PMI_KVS_Fence_group (kvsname, group, n) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Fence_group: \n", rank); grc++;
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    for (r = 0; r < size; r++) {
+        snprintf (key, sizeof (key), "grp-%d", r);
+        snprintf (val, sizeof (val), "grp-val-%d", r);
+        grc += r % 2 == rank % 2 ? expect (key, val) : expect_missing (key);
+    }
+    return grc;
+}
+
+/* each rank reads its left neighbor at a sparse fence, and then its right
+ * one once the sources are set again; no one else's values reach it */
+static int fence_sparse_sources (void)
+{
+    int grc = 0, r, round, src[2];
+    char key[64], val[64];
+
+    src[0] = (size + rank - 1) % size;
+    src[1] = (rank + 1) % size;
+    for (round = 0; round < 2; round++) {
+        if (PMI_KVS_Set_sources (kvsname, &src[round], 1) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Set_sources: \n", rank); grc++;
+        }
+        snprintf (key, sizeof (key), "sp%d-%d", round, rank);
+        snprintf (val, sizeof (val), "sp%d-val-%d", round, rank);
+        if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS
+            || PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+            || PMI_KVS_Fence_sparse (kvsname) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Fence_sparse: \n", rank); grc++;
+        }
+    }
+    if (PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    for (round = 0; round < 2; round++) {
+        for (r = 0; r < size; r++) {
+            snprintf (key, sizeof (key), "sp%d-%d", round, r);
+            snprintf (val, sizeof (val), "sp%d-val-%d", round, r);
+            if (r == src[round]) {
+                grc += expect (key, val);
+            } else if (r != rank) {
+                grc += expect_missing (key);
+            }
+        }
+    }
+    return grc;
+}
+
+/* the ranks of a node, in order and including the caller, as every other
+ * rank of the node has them too */
+static int clique_of_node (void)
+{
+    int grc = 0, i, r, n = 0, clique[size];
+    char key[64], list[256], got[256], *p = list;
+
+    if (PMI_Get_clique_size (&n) != PMI_SUCCESS || n < 1 || n > size
+        || PMI_Get_clique_ranks (clique, n) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: \n", rank);
+        return 1;
+    }
+    if (n > 1 && PMI_Get_clique_ranks (clique, n - 1) != PMI_ERR_INVALID_LENGTH) {
+        fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: short array taken\n", rank); grc++;
+    }
+    for (i = 0; i < n; i++) {
+        if (clique[i] < 0 || clique[i] >= size || (i > 0 && clique[i] <= clique[i - 1])) {
+            fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: [%d]=%d\n", rank, i, clique[i]); grc++;
+        }
+        if (p < list + sizeof (list)) {
+            p += snprintf (p, list + sizeof (list) - p, "%d,", clique[i]);
+        }
+    }
+    for (i = 0; i < n && clique[i] != rank; i++)
+        ;
+    if (i == n) {
+        fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: caller missing\n", rank); grc++;
+    }
+
+    snprintf (key, sizeof (key), "clq-%d", rank);
+    if (PMI_KVS_Put (kvsname, key, list) != PMI_SUCCESS
+        || PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+        || PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+    }
+    for (i = 0; i < n; i++) {
+        snprintf (key, sizeof (key), "clq-%d", clique[i]);
+        grc += expect (key, list);
+    }
+    for (r = 0, i = 0; r < size; r++) {
+        if (i < n && clique[i] == r) {
+            i++;
+            continue;
+        }
+        snprintf (key, sizeof (key), "clq-%d", r);
+        if (PMI_KVS_Get (kvsname, key, got, sizeof (got)) != PMI_SUCCESS
+            || strcmp (got, list) == 0) {
+            fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: rank %d has (%s)\n", rank, r, got); grc++;
+        }
+    }
+    return grc;
+}
+
+/* the node of every rank, from PMI_process_mapping applied cyclically as
+ * MPICH does; the ranks it puts on this rank's node are its clique */
+static int process_mapping (void)
+{
+    int grc = 0, i, r, n = 0, nnodes = 0, local = -1, clique[size], node_of[size];
+    int block[3 * 64], nblocks = 0, b, k, j, used;
+    char map[1024], val[64];
+    const char *p;
+
+    if (PMI_KVS_Get (kvsname, "PMI_process_mapping", map, sizeof (map)) != PMI_SUCCESS
+        || strncmp (map, "(vector", 7) != 0) {
+        fprintf (stderr, "%d: [error] PMI_process_mapping: \n", rank);
+        return 1;
+    }
+    for (p = map + 7; nblocks < 64 && sscanf (p, ",(%d,%d,%d)%n", &block[3 * nblocks],
+                                              &block[3 * nblocks + 1],
+                                              &block[3 * nblocks + 2], &used) == 3; p += used) {
+        if (block[3 * nblocks + 1] < 1 || block[3 * nblocks + 2] < 1) {
+            break;
+        }
+        nblocks++;
+    }
+    if (nblocks == 0 || strcmp (p, ")") != 0) {
+        fprintf (stderr, "%d: [error] PMI_process_mapping: (%s)\n", rank, map);
+        return 1;
+    }
+    for (r = 0; r < size; ) {
+        for (b = 0; b < nblocks; b++) {
+            for (k = 0; k < block[3 * b + 1]; k++) {
+                for (j = 0; j < block[3 * b + 2] && r < size; j++) {
+                    node_of[r++] = block[3 * b] + k;
+                }
+            }
+        }
+    }
+    for (r = 0; r < size; r++) {
+        if (node_of[r] + 1 > nnodes) {
+            nnodes = node_of[r] + 1;
+        }
+    }
+
+    if (PMI_Get_clique_size (&n) != PMI_SUCCESS
+        || PMI_Get_clique_ranks (clique, size) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Get_clique_ranks: \n", rank);
+        return 1;
+    }
+    for (r = 0, i = 0; r < size; r++) {
+        int member = i < n && clique[i] == r;
+        if (member != (node_of[r] == node_of[rank])) {
+            fprintf (stderr, "%d: [error] PMI_process_mapping: (%s) has rank %d on node %d\n",
+                     rank, map, r, node_of[r]); grc++;
+        }
+        if (r == rank) {
+            local = i;
+        }
+        i += member;
+    }
+
+    snprintf (val, sizeof (val), "%d", node_of[rank]);
+    grc += expect ("PMI_MPI_node_id", val);
+    snprintf (val, sizeof (val), "%d", nnodes);
+    grc += expect ("PMI_MPI_num_nodes", val);
+    snprintf (val, sizeof (val), "%d", local);
+    grc += expect ("PMI_MPI_local_rank", val);
+    snprintf (val, sizeof (val), "%d", n);
+    grc += expect ("PMI_MPI_local_size", val);
+    return grc;
+}
+
+/* whether the MPI library libpmi.so brought in was started */
+static int mpi_started (void)
+{
+    int (*initialized) (int *) = (int (*) (int *)) dlsym (RTLD_DEFAULT, "MPI_Initialized");
+    int flag = 0;
+    return initialized != NULL && initialized (&flag) == 0 && flag;
+}
+
+/* under a launcher that sets the rank and size, PMI_Init and what asks
+ * for them leave MPI down; the first put brings it up, with the same rank
+ * and size */
+static int lazy_start (int communicate)
+{
+    static const char *vars[] = { "JSM_NAMESPACE_RANK", "OMPI_COMM_WORLD_RANK", "SLURM_PROCID" };
+    int grc = 0, i, launched = 0, r = -1, n = -1;
+    char key[64], val[64];
+
+    for (i = 0; i < 3; i++) {
+        launched |= getenv (vars[i]) != NULL;
+    }
+    if (launched && mpi_started ()) {
+        fprintf (stderr, "%d: [error] PMI_Init: MPI started\n", rank); grc++;
+    }
+    if (!communicate) {
+        return grc;
+    }
+
+    snprintf (key, sizeof (key), "lz-%d", rank);
+    snprintf (val, sizeof (val), "lz-val-%d", rank);
+    if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+    }
+    if (!mpi_started ()) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Put: MPI not started\n", rank); grc++;
+    }
+    if (PMI_Get_rank (&r) != PMI_SUCCESS || r != rank
+        || PMI_Get_size (&n) != PMI_SUCCESS || n != size) {
+        fprintf (stderr, "%d: [error] PMI_Get_rank: %d of %d once MPI started\n", rank, r, n); grc++;
+    }
+    if (PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+        || PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+    }
+    snprintf (key, sizeof (key), "lz-%d", (rank + 1) % size);
+    snprintf (val, sizeof (val), "lz-val-%d", (rank + 1) % size);
+    grc += expect (key, val);
+    return grc;
+}
+
+/* a step of a job that keeps its snapshots: the first puts two keys per
+ * rank; the second puts only one of them again, and gets the other from
+ * the snapshot; the third puts a new value, and gets nothing stale */
+static int snapshot_step (int step)
+{
+    int grc = 0, left = (size + rank - 1) % size;
+    char key[64], val[64], only[64];
+
+    snprintf (key, sizeof (key), "snap-%d", left);
+    grc += expect_missing (key);
+
+    snprintf (key, sizeof (key), "snap-%d", rank);
+    snprintf (val, sizeof (val), step < 2 ? "snap-val-%d" : "snap-new-%d", rank);
+    snprintf (only, sizeof (only), "snap-only-%d", rank);
+    if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS
+        || (step == 0 && PMI_KVS_Put (kvsname, only, "only") != PMI_SUCCESS)
+        || PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+        || PMI_Barrier () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Barrier: step %d\n", rank, step); grc++;
+    }
+
+    snprintf (key, sizeof (key), "snap-%d", left);
+    snprintf (val, sizeof (val), step < 2 ? "snap-val-%d" : "snap-new-%d", left);
+    snprintf (only, sizeof (only), "snap-only-%d", left);
+    grc += expect (key, val);
+    grc += step < 2 ? expect (only, "only") : expect_missing (only);
+    return grc;
+}
+
+/* every rank's values read by every rank, twice over, with most of them
+ * evicted by the memory budget; a refetch must bring the value of the
+ * latest fence, and a key no one put must still be missing */
+static int budget_refetch (void)
+{
+    int grc = 0, round, r, i;
+    char key[64], val[256];
+
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < 200; i++) {
+            snprintf (key, sizeof (key), "bg-%d-%d", rank, i);
+            snprintf (val, sizeof (val), "%0100d-%d", i, round);
+            if (PMI_KVS_Put (kvsname, key, val) != PMI_SUCCESS) {
+                fprintf (stderr, "%d: [error] PMI_KVS_Put: \n", rank); grc++;
+                break;
+            }
+        }
+        if (PMI_KVS_Commit (kvsname) != PMI_SUCCESS
+            || PMI_Barrier () != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_Barrier: \n", rank); grc++;
+        }
+        for (r = 0; r < size; r++) {
+            for (i = 0; i < 200; i++) {
+                snprintf (key, sizeof (key), "bg-%d-%d", r, i);
+                snprintf (val, sizeof (val), "%0100d-%d", i, round);
+                grc += expect (key, val);
+            }
+        }
+        grc += expect_missing ("bg-none");
+    }
+    return grc;
+}
+
+/* PMI_Finalize, with the stats line it prints to stdout checked for
+ * evictions and refetches; with one rank, every value is its own and
+ * nothing is evicted */
+static int finalize_evicted (void)
+{
+    int grc = 0, saved;
+    unsigned long evictions = 0, refetches = 0;
+    char line[1024], *p;
+    FILE *out = tmpfile ();
+
+    fflush (stdout);
+    if (out == NULL || (saved = dup (STDOUT_FILENO)) < 0) {
+        fprintf (stderr, "%d: [error] tmpfile: \n", rank);
+        return 1 + (PMI_Finalize () != PMI_SUCCESS);
+    }
+    dup2 (fileno (out), STDOUT_FILENO);
+    if (PMI_Finalize () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Finalize: \n", rank); grc++;
+    }
+    fflush (stdout);
+    dup2 (saved, STDOUT_FILENO);
+    close (saved);
+    rewind (out);
+    while (fgets (line, sizeof (line), out) != NULL) {
+        fputs (line, stdout);
+        if ( (p = strstr (line, "evictions=")) != NULL) {
+            sscanf (p, "evictions=%lu refetches=%lu", &evictions, &refetches);
+        }
+    }
+    fclose (out);
+    if (size > 1 && (evictions == 0 || refetches == 0)) {
+        fprintf (stderr, "%d: [error] PMI_MPI_MEM_BUDGET: evictions=%lu refetches=%lu\n",
+                 rank, evictions, refetches); grc++;
+    }
+    return grc;
+}
+
+/* more spaces over the job than are open at once; a created space starts
+ * out empty */
+static int create_destroy_cycles (void)
+{
+    int grc = 0, i;
+    char name[256], key[64], val[64], got[64];
+
+    for (i = 0; i < 100 && grc == 0; i++) {
+        if (PMI_KVS_Create (name, sizeof (name)) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Create: cycle %d\n", rank, i); grc++;
+            break;
+        }
+        if (PMI_KVS_Get (name, "cycle", got, sizeof (got)) == PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Get: %s not empty\n", rank, name); grc++;
+        }
+        snprintf (key, sizeof (key), "cycle-%d", rank);
+        snprintf (val, sizeof (val), "%d", i);
+        if (PMI_KVS_Put (name, "cycle", val) != PMI_SUCCESS
+            || PMI_KVS_Put (name, key, val) != PMI_SUCCESS
+            || PMI_KVS_Commit (name) != PMI_SUCCESS
+            || PMI_KVS_Fence (name) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Fence: %s\n", rank, name); grc++;
+        }
+        snprintf (key, sizeof (key), "cycle-%d", (rank + 1) % size);
+        if (PMI_KVS_Get (name, key, got, sizeof (got)) != PMI_SUCCESS
+            || strcmp (got, val) != 0) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Get: %s in %s\n", rank, key, name); grc++;
+        }
+        if (PMI_KVS_Destroy (name) != PMI_SUCCESS) {
+            fprintf (stderr, "%d: [error] PMI_KVS_Destroy: %s\n", rank, name); grc++;
+        }
+    }
+    return grc;
+}
+
+int main (int argc, char *argv[])
+{
+    int grc = 0, spawned = 0;
+    const char *mode = argc > 1 ? argv[1] : "";
+    static const char *steps[] = { "persist", "restore", "restore-changed" };
+    int step = -1, i;
+
+    for (i = 0; i < 3; i++) {
+        if (strcmp (mode, steps[i]) == 0) {
+            step = i;
+        }
+    }
+    if (step >= 0) {
+        if (argc < 3) {
+            fprintf (stderr, "Usage: %s %s DIR\n", argv[0], mode);
+            return 1;
+        }
+        setenv ("PMI_MPI_SNAPSHOT_DIR", argv[2], 1);
+    }
+    if (strcmp (mode, "budget") == 0) {
+        setenv ("PMI_MPI_MEM_BUDGET", "16K", 1);
+        setenv ("PMI_MPI_STATS", "1", 1);
+    }
+
+    /* large fences are decoded by several threads */
+    setenv ("PMI_MPI_DECODE_THREADS", "4", 0);
+    if (PMI_Init (&spawned) != PMI_SUCCESS) {
+        fprintf (stderr, "PMI_Init:\n"); grc++;
+    }
+    if (PMI_Get_size (&size) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Get_size: \n", rank); grc++;
+    }
+    if (PMI_Get_rank (&rank) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Get_rank:\n", rank); grc++;
+    }
+    if (PMI_KVS_Get_my_name (kvsname, sizeof (kvsname)) != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_KVS_Get_my_name: \n", rank); grc++;
+    }
+
+    if (strcmp (mode, "lazy") == 0 || strcmp (mode, "idle") == 0) {
+        grc += lazy_start (strcmp (mode, "lazy") == 0);
+    } else if (step >= 0) {
+        grc += snapshot_step (step);
+    } else if (strcmp (mode, "budget") == 0) {
+        grc += budget_refetch ();
+    } else {
+        grc += put_to_rank_key ();
+        grc += put_to_busy_fence ();
+        grc += put_to_routing ();
+        grc += rank_key_registered_late ();
+        grc += create_destroy_cycles ();
+        grc += fence_group_members ();
+        grc += fence_sparse_sources ();
+        grc += clique_of_node ();
+        grc += process_mapping ();
+    }
+
+    if (strcmp (mode, "budget") == 0) {
+        grc += finalize_evicted ();
+    } else if (PMI_Finalize () != PMI_SUCCESS) {
+        fprintf (stderr, "%d: [error] PMI_Finalize: \n", rank);
+        grc++;
+    }
+
+    if (grc != 0) {
+        fprintf (stdout, "%d: FAILED\n", rank);
+    } else {
+        fprintf (stdout, "%d: SUCCESS\n", rank);
+    }
+
+    return grc != 0;
+}
@@ -0,0 +1,101 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <system_error>
+#include "progress.hpp"
+
+progress_t::progress_t ()
+  : m_next_ticket (1), m_ran (0), m_stopping (false), m_running (false)
+{
+}
+
+progress_t::~progress_t ()
+{
+  stop ();
+}
+
+bool progress_t::start ()
+{
+  if (m_running) {
+    return true;
+  }
+  m_stopping = false;
+  try {
+    m_thread = std::thread (&progress_t::run, this);
+  } catch (const std::system_error &) {
+    return false;
+  }
+  m_running = true;
+  return true;
+}
+
+void progress_t::stop ()
+{
+  if (!m_running) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard (m_lock);
+    m_stopping = true;
+  }
+  m_posted.notify_one ();
+  m_thread.join ();
+  m_running = false;
+}
+
+uint64_t progress_t::post (std::function<int ()> fn)
+{
+  uint64_t ticket;
+  {
+    std::lock_guard<std::mutex> guard (m_lock);
+    ticket = m_next_ticket++;
+    m_queue.push_back (fn);
+  }
+  m_posted.notify_one ();
+  return ticket;
+}
+
+int progress_t::wait (uint64_t ticket)
+{
+  std::unique_lock<std::mutex> guard (m_lock);
+  std::map<uint64_t, int>::iterator r;
+  while ( (r = m_results.find (ticket)) == m_results.end ()) {
+    m_done.wait (guard);
+  }
+  int rc = r->second;
+  m_results.erase (r);
+  return rc;
+}
+
+/* tickets are handed out in queue order, so the work at the head of the
+ * queue always has the lowest ticket not yet run */
+void progress_t::run ()
+{
+  std::unique_lock<std::mutex> guard (m_lock);
+  for (;;) {
+    while (m_queue.empty () && !m_stopping) {
+      m_posted.wait (guard);
+    }
+    if (m_queue.empty ()) {
+      break;
+    }
+    std::function<int ()> fn = m_queue.front ();
+    m_queue.pop_front ();
+    guard.unlock ();
+    int rc = fn ();
+    guard.lock ();
+    m_results[++m_ran] = rc;
+    m_done.notify_all ();
+  }
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
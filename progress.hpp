@@ -0,0 +1,68 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * progress.hpp
+ *
+ * Optional helper thread that makes the library's MPI calls on behalf of
+ * application threads. Work is posted as a function returning a PMI
+ * return code and run in posting order; the poster gets a ticket to
+ * wait on, and sleeps on a condition variable meanwhile rather than
+ * spinning in MPI.
+ */
+
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+class progress_t {
+public:
+  progress_t ();
+  ~progress_t ();
+
+  bool start ();
+  /* runs whatever is still queued, then joins the thread */
+  void stop ();
+  bool running () const { return m_running; }
+
+  uint64_t post (std::function<int ()> fn);
+  /* result of the work with this ticket, once it has run */
+  int wait (uint64_t ticket);
+
+private:
+  progress_t (const progress_t &);
+  progress_t &operator= (const progress_t &);
+
+  void run ();
+
+  std::thread m_thread;
+  std::mutex m_lock;
+  std::condition_variable m_posted;
+  std::condition_variable m_done;
+  std::deque<std::function<int ()> > m_queue;
+  std::map<uint64_t, int> m_results;
+  uint64_t m_next_ticket;
+  uint64_t m_ran;
+  bool m_stopping;
+  bool m_running;
+};
+
+#endif // PROGRESS_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
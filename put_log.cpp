@@ -0,0 +1,105 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <algorithm>
+#include "put_log.hpp"
+
+/* how far merge_into walks the store before falling back to a search */
+#define PUT_LOG_MAX_WALK 8
+
+void put_log_t::sort ()
+{
+  /* stable, so the slots of a key stay in put order and the last one of
+   * each run is the latest put */
+  kv_str_less_t less;
+  m_order.resize (m_slots.size ());
+  for (size_t i = 0; i < m_order.size (); i++) {
+    m_order[i] = i;
+  }
+  std::stable_sort (m_order.begin (), m_order.end (),
+                    [&] (uint32_t a, uint32_t b) {
+    return less (m_slots.key (a), m_slots.key (b));
+  });
+
+  size_t out = 0;
+  for (size_t i = 0; i < m_order.size (); i++) {
+    if (i + 1 < m_order.size ()
+        && !less (m_slots.key (m_order[i]), m_slots.key (m_order[i + 1]))) {
+      continue;
+    }
+    m_order[out++] = m_order[i];
+  }
+  m_order.resize (out);
+}
+
+int put_log_t::merge_into (map_wrap_t &store) const
+{
+  kv_str_less_t less;
+  kv_map_t &m = store.m_map;
+  kv_map_t::iterator it = m.begin ();
+
+  /* the log is sorted, so the insertion point only ever moves forward:
+   * step along the store while it is close and search when it is not */
+  std::vector<uint32_t>::const_iterator o;
+  for (o = m_order.begin (); o != m_order.end (); o++) {
+    kv_str_t k = m_slots.key (*o);
+    kv_str_t v = m_slots.value (*o);
+    int col, rank;
+    if ( (col = store.match_rank_key (k.ptr, k.len, &rank)) >= 0) {
+      if (!store.assign_rank (col, rank, v.ptr, v.len)) {
+        return -1;
+      }
+      continue;
+    }
+
+    int walk = 0;
+    while (it != m.end () && less (it->first, k)
+           && walk++ < PUT_LOG_MAX_WALK) {
+      it++;
+    }
+    if (it != m.end () && less (it->first, k)) {
+      it = m.lower_bound (k);
+    }
+
+    kv_str_t value = store.intern (v.ptr, v.len);
+    if (value.ptr == NULL) {
+      return -1;
+    }
+    if (it != m.end () && !less (k, it->first)) {
+      it->second = value;
+    } else {
+      kv_str_t key;
+      key.ptr = store.m_arena.dup (k.ptr, k.len);
+      key.len = k.len;
+      if (key.ptr == NULL) {
+        return -1;
+      }
+      it = m.insert (it, kv_pair_t (key, value));
+    }
+    it++;
+  }
+  return 0;
+}
+
+void put_log_t::clear ()
+{
+  m_slots.clear ();
+  m_order.clear ();
+}
+
+void put_log_t::release ()
+{
+  m_slots.release ();
+  std::vector<uint32_t> ().swap (m_order);
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,147 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * put_log.hpp
+ *
+ * PMI_KVS_Put appends to a contiguous log rather than inserting into a
+ * map. At commit time the log is sorted once, each key keeps only its
+ * latest put (last writer wins), and the result is merged in key order
+ * into the committed map_wrap_t.
+ *
+ * The log is a table of fixed-width slots, its columns stored apart
+ * (lengths, key bytes, value bytes), with room in each slot for keys and
+ * values up to the capacities the table is instantiated with. Longer
+ * ones go to the arena and their slot holds a pointer instead. Clearing
+ * keeps the columns' memory, so once the log has grown to a thread's
+ * number of puts per fence, appending short pairs allocates nothing.
+ */
+
+#ifndef PUT_LOG_HPP
+#define PUT_LOG_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "arena.hpp"
+#include "map_wrap.hpp"
+
+/* enough for the business cards MPI libraries put, which are short */
+#define PUT_LOG_KEY_CAP 64
+#define PUT_LOG_VAL_CAP 128
+
+template <size_t KEY_CAP, size_t VAL_CAP>
+class kv_slot_table_t {
+public:
+  bool append (const char *key, size_t key_len,
+               const char *value, size_t value_len)
+  {
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+      return false;
+    }
+    size_t n = m_key_len.size ();
+    m_keys.resize ((n + 1) * KEY_CAP);
+    m_vals.resize ((n + 1) * VAL_CAP);
+    if (!store (&m_keys[n * KEY_CAP], KEY_CAP, key, key_len)
+        || !store (&m_vals[n * VAL_CAP], VAL_CAP, value, value_len)) {
+      m_keys.resize (n * KEY_CAP);
+      m_vals.resize (n * VAL_CAP);
+      return false;
+    }
+    m_key_len.push_back (key_len);
+    m_val_len.push_back (value_len);
+    return true;
+  }
+
+  size_t size () const { return m_key_len.size (); }
+  bool empty () const { return m_key_len.empty (); }
+
+  /* valid until the next append () */
+  kv_str_t key (size_t i) const
+  {
+    return load (&m_keys[i * KEY_CAP], KEY_CAP, m_key_len[i]);
+  }
+  kv_str_t value (size_t i) const
+  {
+    return load (&m_vals[i * VAL_CAP], VAL_CAP, m_val_len[i]);
+  }
+
+  void clear ()
+  {
+    m_key_len.clear ();
+    m_val_len.clear ();
+    m_keys.clear ();
+    m_vals.clear ();
+    m_arena.reset ();
+  }
+
+  void release ()
+  {
+    std::vector<uint32_t> ().swap (m_key_len);
+    std::vector<uint32_t> ().swap (m_val_len);
+    std::vector<char> ().swap (m_keys);
+    std::vector<char> ().swap (m_vals);
+    m_arena.release ();
+  }
+
+private:
+  static_assert (KEY_CAP >= sizeof (char *) && VAL_CAP >= sizeof (char *),
+                 "a slot must be able to hold a pointer");
+
+  bool store (char *slot, size_t cap, const char *s, size_t len)
+  {
+    if (len <= cap) {
+      memcpy (slot, s, len);
+      return true;
+    }
+    char *out = m_arena.dup (s, len);
+    memcpy (slot, &out, sizeof (out));
+    return out != NULL;
+  }
+
+  static kv_str_t load (const char *slot, size_t cap, uint32_t len)
+  {
+    kv_str_t s = { slot, len };
+    if (len > cap) {
+      memcpy (&s.ptr, slot, sizeof (s.ptr));
+    }
+    return s;
+  }
+
+  /* only for what does not fit in a slot */
+  arena_t m_arena;
+  std::vector<uint32_t> m_key_len;
+  std::vector<uint32_t> m_val_len;
+  std::vector<char> m_keys;
+  std::vector<char> m_vals;
+};
+
+struct put_log_t {
+  bool append (const char *key, size_t key_len,
+               const char *value, size_t value_len)
+  {
+    return m_slots.append (key, key_len, value, value_len);
+  }
+  bool empty () const { return m_slots.empty (); }
+  void sort ();
+  int merge_into (map_wrap_t &store) const;
+  void clear ();
+  void release ();
+
+  kv_slot_table_t<PUT_LOG_KEY_CAP, PUT_LOG_VAL_CAP> m_slots;
+  /* after sort (), the slot of the latest put of each key, in key order */
+  std::vector<uint32_t> m_order;
+};
+
+#endif // PUT_LOG_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
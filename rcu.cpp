@@ -0,0 +1,92 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "rcu.hpp"
+
+/* epoch is the grace period a reader entered in, 0 while it is outside
+ * a read section; one cache line each so readers do not share lines */
+struct rcu_slot_t {
+  std::atomic<uint64_t> epoch;
+  std::atomic<bool> used;
+} __attribute__ ((aligned (64)));
+
+static rcu_slot_t slots[RCU_MAX_READERS];
+static std::atomic<int> nslots (0);
+static std::atomic<uint64_t> epoch (1);
+
+/* the calling thread's slot, released when the thread exits */
+struct rcu_reader_t {
+  int slot;
+  rcu_reader_t () : slot (-1) {}
+  ~rcu_reader_t ()
+  {
+    if (slot >= 0) {
+      slots[slot].used.store (false, std::memory_order_release);
+    }
+  }
+};
+static thread_local rcu_reader_t reader;
+
+static int claim_slot ()
+{
+  for (int i = 0; i < RCU_MAX_READERS; i++) {
+    bool expected = false;
+    if (slots[i].used.load (std::memory_order_relaxed)
+        || !slots[i].used.compare_exchange_strong (expected, true)) {
+      continue;
+    }
+    /* rcu_synchronize () only scans slots below the high-water mark */
+    int n = nslots.load ();
+    while (n < i + 1 && !nslots.compare_exchange_weak (n, i + 1)) {
+    }
+    return i;
+  }
+  return -1;
+}
+
+bool rcu_read_lock ()
+{
+  if (reader.slot < 0 && (reader.slot = claim_slot ()) < 0) {
+    return false;
+  }
+  /* with the fence in rcu_synchronize (), the writer either sees this
+   * store or the reader's loads after the fence see the writer's new
+   * pointer, whatever order the caller loads the pointer with */
+  slots[reader.slot].epoch.store (epoch.load ());
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  return true;
+}
+
+void rcu_read_unlock ()
+{
+  slots[reader.slot].epoch.store (0, std::memory_order_release);
+}
+
+void rcu_synchronize ()
+{
+  /* pairs with the fence in rcu_read_lock (): the pointer the caller
+   * replaced is stored before any slot is read */
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  uint64_t e = epoch.fetch_add (1) + 1;
+  int n = nslots.load ();
+  for (int i = 0; i < n; i++) {
+    uint64_t v;
+    while ( (v = slots[i].epoch.load ()) != 0 && v < e) {
+      std::this_thread::yield ();
+    }
+  }
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,40 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * rcu.hpp
+ *
+ * Minimal read-copy-update for the published KVS snapshot. Readers mark
+ * themselves active in a per-thread slot for the duration of a lookup;
+ * they never take a lock or write shared state other than their own
+ * slot. The writer publishes a new pointer and then rcu_synchronize ()
+ * waits until no reader can still hold the old one, after which it may
+ * be freed.
+ *
+ * Slots are claimed on a thread's first read and given back when it
+ * exits. When all RCU_MAX_READERS are taken rcu_read_lock () fails and
+ * the caller must fall back to excluding the writer some other way.
+ * Read sections must not nest.
+ */
+
+#ifndef RCU_HPP
+#define RCU_HPP
+
+#define RCU_MAX_READERS 256
+
+bool rcu_read_lock ();
+void rcu_read_unlock ();
+void rcu_synchronize ();
+
+#endif // RCU_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
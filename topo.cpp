@@ -0,0 +1,115 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+#include <mpi.h>
+#include <stdio.h>
+#include "topo.hpp"
+
+bool node_topo_t::init ()
+{
+  int rank, size;
+  MPI_Comm node;
+  if (MPI_Comm_rank (MPI_COMM_WORLD, &rank) != MPI_SUCCESS
+      || MPI_Comm_split_type (MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                              MPI_INFO_NULL, &node) != MPI_SUCCESS) {
+    return false;
+  }
+
+  /* keyed by 0, the node communicator keeps world order */
+  bool ok = MPI_Comm_size (node, &size) == MPI_SUCCESS;
+  if (ok) {
+    m_clique.resize (size);
+    ok = MPI_Allgather (&rank, 1, MPI_INT, m_clique.data (), 1, MPI_INT,
+                        node) == MPI_SUCCESS;
+  }
+  MPI_Comm_free (&node);
+  if (!ok) {
+    return false;
+  }
+
+  /* a node is known by its lowest rank, which is its first to appear */
+  if (MPI_Comm_size (MPI_COMM_WORLD, &size) != MPI_SUCCESS) {
+    return false;
+  }
+  std::vector<int> leader (size);
+  if (MPI_Allgather (&m_clique[0], 1, MPI_INT, leader.data (), 1, MPI_INT,
+                     MPI_COMM_WORLD) != MPI_SUCCESS) {
+    return false;
+  }
+  m_node_of.resize (size);
+  m_nnodes = 0;
+  for (int r = 0; r < size; r++) {
+    m_node_of[r] = leader[r] == r ? m_nnodes++ : m_node_of[leader[r]];
+  }
+  return true;
+}
+
+struct map_block_t {
+  int node;
+  int nodes;
+  int ppn;
+  bool operator== (const map_block_t &o) const
+  {
+    return node == o.node && nodes == o.nodes && ppn == o.ppn;
+  }
+};
+
+std::string node_topo_t::process_mapping () const
+{
+  /* runs of consecutive ranks on one node, then runs of equal sized such
+   * runs on consecutive nodes */
+  std::vector<map_block_t> blocks;
+  for (size_t r = 0; r < m_node_of.size (); ) {
+    size_t end = r;
+    while (end < m_node_of.size () && m_node_of[end] == m_node_of[r]) {
+      end++;
+    }
+    map_block_t run = { m_node_of[r], 1, (int) (end - r) };
+    map_block_t *last = blocks.empty () ? NULL : &blocks.back ();
+    if (last != NULL && last->ppn == run.ppn
+        && last->node + last->nodes == run.node) {
+      last->nodes++;
+    } else {
+      blocks.push_back (run);
+    }
+    r = end;
+  }
+
+  /* the mapping is applied cyclically, so a round-robin placement is
+   * given by its first period */
+  size_t period = blocks.size ();
+  for (size_t p = 1; p < blocks.size (); p++) {
+    if (blocks.size () % p != 0) {
+      continue;
+    }
+    size_t i = p;
+    while (i < blocks.size () && blocks[i] == blocks[i - p]) {
+      i++;
+    }
+    if (i == blocks.size ()) {
+      period = p;
+      break;
+    }
+  }
+
+  std::string map = "(vector";
+  char buf[64];
+  for (size_t i = 0; i < period; i++) {
+    snprintf (buf, sizeof (buf), ",(%d,%d,%d)", blocks[i].node,
+              blocks[i].nodes, blocks[i].ppn);
+    map += buf;
+  }
+  map += ")";
+  return map;
+}
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */
@@ -0,0 +1,53 @@
+/************************************************************\
+ * Copyright 2019 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/*
+ * topo.hpp
+ *
+ * Node topology of the job, worked out once by PMI_Init with
+ * MPI_Comm_split_type, so that clique queries need no communication and
+ * clients need not trade hostnames through the KVS to find their peers.
+ * Nodes are numbered in the order of their lowest rank.
+ */
+
+#ifndef TOPO_HPP
+#define TOPO_HPP
+
+#include <string>
+#include <vector>
+
+class node_topo_t {
+public:
+  node_topo_t () : m_nnodes (0) {}
+
+  /* collective over MPI_COMM_WORLD */
+  bool init ();
+
+  /* world ranks on this node, in increasing order */
+  const std::vector<int> &clique () const { return m_clique; }
+  /* node of every rank */
+  const std::vector<int> &node_of () const { return m_node_of; }
+  int nnodes () const { return m_nnodes; }
+
+  /* PMI_process_mapping value in MPICH's "(vector,(node,nodes,ppn)...)"
+   * form, with a layout that repeats given once */
+  std::string process_mapping () const;
+
+private:
+  std::vector<int> m_clique;
+  std::vector<int> m_node_of;
+  int m_nnodes;
+};
+
+#endif // TOPO_HPP
+
+/*
+ * vi:tabstop=2 shiftwidth=2 expandtab
+ */